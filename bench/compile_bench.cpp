@@ -0,0 +1,249 @@
+#include "compile_worker.hpp"
+#include "simulator.hpp"
+
+#include <kar/kar.hpp>
+#include <pcompiler/pcompiler.hpp>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QVector>
+#include <algorithm>
+
+namespace
+{
+  // The stages ServerThread::handleAction puts every upload through
+  enum Stage
+  {
+    Load = 0,
+    Extract,
+    Compile,
+    Install,
+    Cleanup,
+    StageCount
+  };
+  
+  const char *const stageNames[StageCount] = {
+    "load",
+    "extract",
+    "compile",
+    "install",
+    "cleanup"
+  };
+  
+  struct Workload
+  {
+    QString name;
+    kiss::KarPtr archive;
+  };
+  
+  // Deterministic filler so assets neither compress nor vary between runs
+  QByteArray noise(const int size, quint32 state)
+  {
+    QByteArray data(size, 0);
+    for(int i = 0; i < size; ++i) {
+      state = state * 1664525u + 1013904223u;
+      data[i] = state >> 24;
+    }
+    return data;
+  }
+  
+  QByteArray helloWorld()
+  {
+    return "#include <stdio.h>\n"
+      "\n"
+      "int main()\n"
+      "{\n"
+      "\tprintf(\"Hello, World!\\n\");\n"
+      "\treturn 0;\n"
+      "}\n";
+  }
+  
+  QVector<Workload> workloads()
+  {
+    QVector<Workload> ret;
+  
+    Workload single;
+    single.name = "c_single";
+    single.archive = kiss::KarPtr(new kiss::Kar());
+    single.archive->setFile("main.c", helloWorld());
+    ret.append(single);
+  
+    // Twenty translation units, each with its own header
+    Workload multi;
+    multi.name = "c_20_files";
+    multi.archive = kiss::KarPtr(new kiss::Kar());
+    QByteArray main = "#include <stdio.h>\n";
+    QByteArray calls;
+    for(int i = 0; i < 20; ++i) {
+      const QByteArray n = QByteArray::number(i);
+      multi.archive->setFile("unit" + n + ".h", "int unit" + n + "(int x);\n");
+      QByteArray unit = "#include \"unit" + n + ".h\"\n\nint unit" + n + "(int x)\n{\n\tint i;\n";
+      unit += "\tfor(i = 0; i < " + n + "; ++i) x = x * 31 + i;\n\treturn x;\n}\n";
+      multi.archive->setFile("unit" + n + ".c", unit);
+      main += "#include \"unit" + n + ".h\"\n";
+      calls += "\tprintf(\"%d\\n\", unit" + n + "(" + n + "));\n";
+    }
+    multi.archive->setFile("main.c", main + "\nint main()\n{\n" + calls + "\treturn 0;\n}\n");
+    ret.append(multi);
+  
+    // C++ spending most of its time in the standard library headers
+    Workload cpp;
+    cpp.name = "cpp_headers";
+    cpp.archive = kiss::KarPtr(new kiss::Kar());
+    QByteArray includes;
+    QByteArray uses;
+    for(int i = 0; i < 30; ++i) {
+      const QByteArray n = QByteArray::number(i);
+      QByteArray header = "#ifndef _PART" + n + "_HPP_\n#define _PART" + n + "_HPP_\n\n";
+      header += "#include <map>\n#include <string>\n#include <vector>\n#include <algorithm>\n\n";
+      header += "class Part" + n + "\n{\npublic:\n";
+      header += "\tvoid add(const std::string &key, int value) { _values[key].push_back(value); }\n";
+      header += "\tint max(const std::string &key) const\n\t{\n";
+      header += "\t\tstd::map<std::string, std::vector<int> >::const_iterator it = _values.find(key);\n";
+      header += "\t\treturn it == _values.end() ? 0 : *std::max_element(it->second.begin(), it->second.end());\n";
+      header += "\t}\n\nprivate:\n\tstd::map<std::string, std::vector<int> > _values;\n};\n\n#endif\n";
+      cpp.archive->setFile("part" + n + ".hpp", header);
+      includes += "#include \"part" + n + ".hpp\"\n";
+      uses += "\tPart" + n + " p" + n + ";\n\tp" + n + ".add(\"a\", " + n + ");\n";
+      uses += "\tstd::cout << p" + n + ".max(\"a\") << std::endl;\n";
+    }
+    cpp.archive->setFile("main.cpp", "#include <iostream>\n" + includes + "\nint main()\n{\n" + uses + "\treturn 0;\n}\n");
+    ret.append(cpp);
+  
+    // A small program shipping large data files
+    Workload assets;
+    assets.name = "c_assets_8mib";
+    assets.archive = kiss::KarPtr(new kiss::Kar());
+    assets.archive->setFile("main.c", helloWorld());
+    for(int i = 0; i < 4; ++i) {
+      assets.archive->setFile("asset" + QString::number(i) + ".bin", noise(2 << 20, i + 1));
+    }
+    ret.append(assets);
+  
+    return ret;
+  }
+  
+  struct Summary
+  {
+    qint64 median;
+    qint64 min;
+    qint64 max;
+  };
+  
+  Summary summarize(QVector<qint64> samples)
+  {
+    std::sort(samples.begin(), samples.end());
+    Summary ret;
+    ret.median = samples[samples.size() / 2];
+    ret.min = samples.first();
+    ret.max = samples.last();
+    return ret;
+  }
+}
+
+// Times every stage an uploaded program goes through, per synthetic
+// archive, and prints the breakdown as JSON. Like ks2 itself it has to run
+// from the deploy directory so platform.hints and the prefix are found:
+//   ks2-compile-bench [--iterations <n>] [--filter <substring>]
+// Exits with 1 if any archive failed to compile.
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("ks2-compile-bench");
+  
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Per-stage benchmark of the compile pipeline");
+  parser.addHelpOption();
+  QCommandLineOption iterations("iterations", "Runs per archive; the median is reported.", "n", "5");
+  QCommandLineOption filter("filter", "Only archives whose name contains this.", "substring");
+  parser.addOption(iterations);
+  parser.addOption(filter);
+  parser.process(app);
+  const int runs = qMax(1, parser.value(iterations).toInt());
+  
+  // Installs go to a throwaway user root instead of KISS Programs
+  QTemporaryDir userRoot;
+  const QString archives = QDir(userRoot.path()).filePath("archives");
+  QDir().mkpath(archives);
+  
+  QFile targetFile(":/target.c");
+  QByteArray target;
+  if(targetFile.open(QIODevice::ReadOnly)) target = targetFile.readAll();
+  
+  bool failed = false;
+  QTextStream out(stdout);
+  out << "{\n";
+  out << "  \"version\": \"" << SIMULATOR_VERSION_MAJOR << "." << SIMULATOR_VERSION_MINOR << "\",\n";
+  out << "  \"iterations\": " << runs << ",\n";
+  out << "  \"results\": [";
+  bool first = true;
+  Q_FOREACH(const Workload &workload, workloads()) {
+    if(parser.isSet(filter) && !workload.name.contains(parser.value(filter))) continue;
+    QTextStream(stderr) << workload.name << endl;
+  
+    // As ServerThread::handleArchive leaves it
+    const QString path = QDir(archives).filePath(workload.name);
+    workload.archive->save(path);
+    const qint64 archiveSize = QFileInfo(path).size();
+  
+    QVector<qint64> samples[StageCount];
+    for(int i = 0; i < runs; ++i) {
+      QElapsedTimer timer;
+      timer.start();
+  
+      const kiss::KarPtr archive = kiss::Kar::load(path);
+      if(archive.isNull()) {
+        failed = true;
+        break;
+      }
+      if(!target.isEmpty()) archive->setFile("__internal_target___.c", target);
+      samples[Load].append(timer.nsecsElapsed());
+  
+      CompileWorker worker(archive, 0);
+      worker.setUserRoot(userRoot.path());
+      timer.restart();
+      if(!worker.extract()) {
+        worker.cleanup();
+        failed = true;
+        break;
+      }
+      samples[Extract].append(timer.nsecsElapsed());
+  
+      timer.restart();
+      Compiler::OutputList output = worker.compileExtracted();
+      samples[Compile].append(timer.nsecsElapsed());
+  
+      timer.restart();
+      output << Compiler::RootManager(userRoot.path()).install(output, workload.name);
+      samples[Install].append(timer.nsecsElapsed());
+  
+      timer.restart();
+      worker.cleanup();
+      samples[Cleanup].append(timer.nsecsElapsed());
+  
+      Q_FOREACH(const Compiler::Output &o, output) failed |= o.exitCode() != 0;
+    }
+    if(samples[Cleanup].size() != runs) continue;
+  
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "    {\"name\": \"" << workload.name << "\", \"files\": " << workload.archive->files().size()
+      << ", \"archive_bytes\": " << archiveSize << ", \"stages\": {";
+    for(int i = 0; i < StageCount; ++i) {
+      const Summary summary = summarize(samples[i]);
+      out << (i ? ", " : "") << "\"" << stageNames[i] << "\": {\"median_ns\": " << summary.median
+        << ", \"min_ns\": " << summary.min << ", \"max_ns\": " << summary.max << "}";
+    }
+    out << "}}";
+  }
+  out << "\n  ]\n}\n";
+  out.flush();
+  
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+#include "simulator.hpp"
+
+#include <kar/kar.hpp>
+#include <pcompiler/pcompiler.hpp>
+#include <kovanserial/tcp_serial.hpp>
+#include <kovanserial/transport_layer.hpp>
+#include <kovanserial/kovan_serial.hpp>
+#include <kovanserial/command_types.hpp>
+#include <kovanserial/general.hpp>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QDataStream>
+#include <QTextStream>
+#include <QFileInfo>
+#include <QDir>
+#include <QVector>
+#include <algorithm>
+#include <sstream>
+
+// Milliseconds to wait on any one reply; compiles may take much longer
+#define REPLY_TIMEOUT 5000
+#define COMPILE_TIMEOUT 120000
+
+namespace
+{
+  enum Phase
+  {
+    Connect = 0,
+    Handshake,
+    Upload,
+    FirstProgress,
+    Compile,
+    PhaseCount
+  };
+  
+  const char *const phaseNames[PhaseCount] = {
+    "connect",
+    "handshake",
+    "upload",
+    "first_progress",
+    "compile"
+  };
+  
+  struct Options
+  {
+    QByteArray host;
+    quint16 port;
+    int clients;
+    int sessions;
+    bool run;
+    QByteArray archive;
+  };
+  
+  struct Stats
+  {
+    Stats()
+      : sessions(0)
+      , failures(0)
+      , failedCompiles(0)
+      , uploadBytes(0)
+      , uploadNs(0)
+    {
+    }
+  
+    quint64 sessions;
+    quint64 failures;
+    quint64 failedCompiles;
+    quint64 uploadBytes;
+    qint64 uploadNs;
+    QVector<qint64> phases[PhaseCount];
+  };
+  
+  // One student's IDE: connects, says hello, uploads the program, compiles
+  // it and optionally runs it, timing each step from its own start
+  class Client : public QThread
+  {
+  public:
+    Client(const Options &options, const QElapsedTimer &clock, const int id)
+      : _options(options)
+      , _clock(clock)
+      , _id(id)
+    {
+    }
+  
+    const Stats &stats() const
+    {
+      return _stats;
+    }
+  
+  protected:
+    void run()
+    {
+      for(int i = 0; i < _options.sessions; ++i) {
+        ++_stats.sessions;
+        if(!session(QString("ks2-load-%1-%2").arg(_id).arg(i).toStdString())) ++_stats.failures;
+      }
+    }
+  
+  private:
+    bool session(const std::string &name)
+    {
+      qint64 start = _clock.nsecsElapsed();
+      TcpSerial serial(_options.host.constData(), _options.port);
+      if(!serial.makeAvailable()) return false;
+      _stats.phases[Connect].append(lap(start));
+  
+      TransportLayer transport(&serial);
+      KovanSerial proto(&transport);
+      const bool ok = exchange(proto, name);
+      proto.hangup();
+      serial.endSession();
+      return ok;
+    }
+  
+    bool exchange(KovanSerial &proto, const std::string &name)
+    {
+      // The simulator never sets a password, so authentication ends with
+      // the info request
+      qint64 start = _clock.nsecsElapsed();
+      if(!proto.knockKnock(REPLY_TIMEOUT)) return false;
+      bool passworded = false;
+      if(!proto.authenticationInfo(passworded)) return false;
+      _stats.phases[Handshake].append(lap(start));
+  
+      const QByteArray &archive = _options.archive;
+      if(!proto.sendFile(name, "kar", reinterpret_cast<const unsigned char *>(archive.constData()), archive.size())) {
+        return false;
+      }
+      const qint64 upload = lap(start);
+      _stats.phases[Upload].append(upload);
+      _stats.uploadBytes += archive.size();
+      _stats.uploadNs += upload;
+  
+      if(!proto.sendFileAction(COMMAND_ACTION_COMPILE, name)) return false;
+      bool finished = false;
+      bool first = true;
+      double progress = 0.0;
+      while(!finished) {
+        if(!proto.recvFileActionProgress(finished, progress, COMPILE_TIMEOUT)) return false;
+        if(first) _stats.phases[FirstProgress].append(_clock.nsecsElapsed() - start);
+        first = false;
+      }
+  
+      // The diagnostics follow as a serialized output list
+      Packet p;
+      if(proto.next(p, REPLY_TIMEOUT) != TransportLayer::Success || p.type != Command::FileHeader) return false;
+      Command::FileHeaderData header;
+      p.as(header);
+      std::ostringstream file(std::ios::binary);
+      if(!proto.confirmFile(true) || !proto.recvFile(header.size, &file, REPLY_TIMEOUT)) return false;
+      _stats.phases[Compile].append(lap(start));
+  
+      const std::string data = file.str();
+      const QByteArray arr(data.c_str(), data.size());
+      QDataStream stream(arr);
+      Compiler::OutputList output;
+      stream >> output;
+      Q_FOREACH(const Compiler::Output &o, output) {
+        if(o.exitCode() == 0) continue;
+        ++_stats.failedCompiles;
+        break;
+      }
+  
+      if(_options.run && !proto.sendFileAction(COMMAND_ACTION_RUN, name)) return false;
+      return true;
+    }
+  
+    // Nanoseconds since start, restarting it
+    qint64 lap(qint64 &start) const
+    {
+      const qint64 now = _clock.nsecsElapsed();
+      const qint64 elapsed = now - start;
+      start = now;
+      return elapsed;
+    }
+  
+    const Options &_options;
+    const QElapsedTimer &_clock;
+    int _id;
+    Stats _stats;
+  };
+  
+  qint64 percentile(const QVector<qint64> &sorted, const double p)
+  {
+    if(sorted.isEmpty()) return 0;
+    const int i = qMin(sorted.size() - 1, static_cast<int>(p * sorted.size()));
+    return sorted[i];
+  }
+  
+  // A recorded program: a .kar as the IDE uploads it, or a directory or
+  // source file packed into one
+  bool loadArchive(const QString &path, QByteArray &out)
+  {
+    const QFileInfo info(path);
+    kiss::KarPtr archive;
+    if(info.isDir()) {
+      archive = kiss::KarPtr(new kiss::Kar());
+      Q_FOREACH(const QFileInfo &file, QDir(path).entryInfoList(QDir::Files)) {
+        QFile source(file.filePath());
+        if(!source.open(QIODevice::ReadOnly)) return false;
+        archive->setFile(file.fileName(), source.readAll());
+      }
+    } else if(info.suffix() == "kar") {
+      archive = kiss::Kar::load(path);
+    } else {
+      QFile source(path);
+      if(!source.open(QIODevice::ReadOnly)) return false;
+      archive = kiss::KarPtr(new kiss::Kar());
+      archive->setFile(info.fileName(), source.readAll());
+    }
+    if(archive.isNull()) return false;
+  
+    QDataStream stream(&out, QIODevice::WriteOnly);
+    stream << *archive;
+    return true;
+  }
+  
+  // Stands in for a typical first assignment
+  QByteArray syntheticArchive()
+  {
+    kiss::Kar archive;
+    archive.setFile("main.c",
+      "#include <stdio.h>\n"
+      "\n"
+      "int main()\n"
+      "{\n"
+      "\tprintf(\"Hello, World!\\n\");\n"
+      "\treturn 0;\n"
+      "}\n");
+    QByteArray out;
+    QDataStream stream(&out, QIODevice::WriteOnly);
+    stream << archive;
+    return out;
+  }
+}
+
+// Rehearses a classroom uploading and compiling at once against a running
+// simulator and prints per-phase latencies as JSON:
+//   ks2-ide-load --clients 20 --sessions 3 [--program <kar, dir or .c>]
+// Exits with 1 if any session failed.
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("ks2-ide-load");
+  
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Load tester for the simulator's program server");
+  parser.addHelpOption();
+  QCommandLineOption host("host", "Simulator address.", "address", "127.0.0.1");
+  QCommandLineOption port("port", "Program server port.", "port", QString::number(KOVAN_SERIAL_PORT + 1));
+  QCommandLineOption clients("clients", "Concurrent IDEs.", "n", "10");
+  QCommandLineOption sessions("sessions", "Sessions each IDE runs back to back.", "n", "1");
+  QCommandLineOption program("program", "Program to upload instead of a hello world.", "path");
+  QCommandLineOption run("run", "Run the program after compiling it.");
+  parser.addOption(host);
+  parser.addOption(port);
+  parser.addOption(clients);
+  parser.addOption(sessions);
+  parser.addOption(program);
+  parser.addOption(run);
+  parser.process(app);
+  
+  Options options;
+  options.host = parser.value(host).toLatin1();
+  options.port = parser.value(port).toUShort();
+  options.clients = qMax(1, parser.value(clients).toInt());
+  options.sessions = qMax(1, parser.value(sessions).toInt());
+  options.run = parser.isSet(run);
+  if(!parser.isSet(program)) options.archive = syntheticArchive();
+  else if(!loadArchive(parser.value(program), options.archive)) {
+    QTextStream(stderr) << "Failed to load " << parser.value(program) << endl;
+    return 2;
+  }
+  
+  QElapsedTimer clock;
+  clock.start();
+  QVector<Client *> threads;
+  for(int i = 0; i < options.clients; ++i) {
+    Client *const client = new Client(options, clock, i);
+    threads.append(client);
+    client->start();
+  }
+  
+  Stats total;
+  Q_FOREACH(Client *const client, threads) {
+    client->wait();
+    const Stats &stats = client->stats();
+    total.sessions += stats.sessions;
+    total.failures += stats.failures;
+    total.failedCompiles += stats.failedCompiles;
+    total.uploadBytes += stats.uploadBytes;
+    total.uploadNs += stats.uploadNs;
+    for(int i = 0; i < PhaseCount; ++i) total.phases[i] += stats.phases[i];
+  }
+  const double seconds = clock.nsecsElapsed() / 1e9;
+  qDeleteAll(threads);
+  
+  QTextStream out(stdout);
+  out << "{\n";
+  out << "  \"version\": \"" << SIMULATOR_VERSION_MAJOR << "." << SIMULATOR_VERSION_MINOR << "\",\n";
+  out << "  \"clients\": " << options.clients << ",\n";
+  out << "  \"archive_bytes\": " << options.archive.size() << ",\n";
+  out << "  \"sessions\": " << total.sessions << ",\n";
+  out << "  \"failures\": " << total.failures << ",\n";
+  out << "  \"failed_compiles\": " << total.failedCompiles << ",\n";
+  out << "  \"wall_s\": " << QString::number(seconds, 'f', 3) << ",\n";
+  out << "  \"upload_bytes_per_s\": "
+    << QString::number(total.uploadNs ? total.uploadBytes / (total.uploadNs / 1e9) : 0.0, 'f', 1) << ",\n";
+  out << "  \"latency_ns\": {";
+  for(int i = 0; i < PhaseCount; ++i) {
+    QVector<qint64> &phase = total.phases[i];
+    std::sort(phase.begin(), phase.end());
+    out << (i ? ",\n" : "\n") << "    \"" << phaseNames[i] << "\": {\"count\": " << phase.size()
+      << ", \"p50\": " << percentile(phase, 0.5)
+      << ", \"p99\": " << percentile(phase, 0.99)
+      << ", \"max\": " << (phase.isEmpty() ? 0 : phase.last()) << "}";
+  }
+  out << "\n  }\n";
+  out << "}\n";
+  out.flush();
+  
+  return total.failures ? 1 : 0;
+}
@@ -0,0 +1,253 @@
+#include "kovan_protocol_p.hpp"
+#include "kovan_regs_p.hpp"
+#include "simulator.hpp"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QUdpSocket>
+#include <QHostAddress>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QVector>
+#include <algorithm>
+#include <cstring>
+
+#define KMOD_PORT 4628
+
+namespace
+{
+  struct Options
+  {
+    QHostAddress host;
+    quint16 port;
+    int clients;
+    int writes;
+    int stateEvery;
+    double rate;
+    double warmup;
+    double duration;
+    int timeout;
+  };
+  
+  // Everything one client saw after the warm-up
+  struct Stats
+  {
+    Stats()
+      : packets(0)
+      , writes(0)
+      , stateRequests(0)
+      , timeouts(0)
+    {
+    }
+  
+    quint64 packets;
+    quint64 writes;
+    quint64 stateRequests;
+    quint64 timeouts;
+    // Round trip of every answered state request
+    QVector<qint64> latencies;
+  };
+  
+  // One simulated controller program on its own socket. State requests
+  // block until the state comes back, like libkovan does; write-only
+  // packets are not answered and are sent fire-and-forget.
+  class Client : public QThread
+  {
+  public:
+    Client(const Options &options, const QElapsedTimer &clock, const int id)
+      : _options(options)
+      , _clock(clock)
+      , _id(id)
+    {
+    }
+  
+    const Stats &stats() const
+    {
+      return _stats;
+    }
+  
+  protected:
+    void run()
+    {
+      QUdpSocket socket;
+      if(!socket.bind(QHostAddress::LocalHost, 0)) return;
+  
+      const int commands = _options.writes + 1;
+      QByteArray datagram(sizeof(Kovan::Packet) + (commands - 1) * sizeof(Kovan::Command), 0);
+      Kovan::State state;
+  
+      const qint64 warmupEnd = _options.warmup * 1e9;
+      const qint64 end = warmupEnd + _options.duration * 1e9;
+      // Paced clients are spread over the interval instead of all sending at once
+      const qint64 interval = _options.rate > 0.0 ? 1e9 / _options.rate : 0;
+      qint64 scheduled = interval * _id / _options.clients;
+  
+      for(quint64 n = 0;; ++n) {
+        qint64 now = _clock.nsecsElapsed();
+        if(interval) {
+          // Sleep most of the way, then spin for an accurate send time
+          if(scheduled - now > 200000) QThread::usleep((scheduled - now - 100000) / 1000);
+          while((now = _clock.nsecsElapsed()) < scheduled);
+        } else scheduled = now;
+        if(now >= end) break;
+  
+        const bool stateRequest = n % _options.stateEvery == 0;
+        fill(datagram, n, stateRequest);
+  
+        // A reply that arrived after its timeout would be taken for this one
+        if(stateRequest) {
+          while(socket.hasPendingDatagrams()) socket.readDatagram(0, 0);
+        }
+  
+        socket.writeDatagram(datagram, _options.host, _options.port);
+  
+        bool answered = false;
+        if(stateRequest) {
+          answered = socket.waitForReadyRead(_options.timeout)
+            && socket.readDatagram(reinterpret_cast<char *>(&state), sizeof(state)) == sizeof(state);
+        }
+  
+        // Latency counts from the scheduled send time, so a stalled server
+        // also shows up in the requests that queued up behind it
+        const qint64 received = _clock.nsecsElapsed();
+        if(scheduled >= warmupEnd) {
+          ++_stats.packets;
+          _stats.writes += _options.writes;
+          if(stateRequest) {
+            ++_stats.stateRequests;
+            if(answered) _stats.latencies.append(received - scheduled);
+            else ++_stats.timeouts;
+          }
+        }
+  
+        scheduled += interval;
+      }
+    }
+  
+  private:
+    // The writes busy-polling programs issue most: motor power, here zero
+    // so the simulated robot stays put
+    void fill(QByteArray &datagram, const quint64 n, const bool stateRequest) const
+    {
+      Kovan::Packet *const packet = reinterpret_cast<Kovan::Packet *>(datagram.data());
+      packet->num = 0;
+      for(int i = 0; i < _options.writes; ++i) {
+        Kovan::WriteCommand write;
+        write.addy = MOTOR_PWM_0 + (n + i) % 4;
+        write.val = 0;
+        Kovan::Command &command = packet->commands[packet->num++];
+        command.type = Kovan::WriteCommandType;
+        memcpy(command.data, &write, sizeof(write));
+      }
+      if(stateRequest) packet->commands[packet->num++].type = Kovan::StateCommandType;
+    }
+  
+    const Options &_options;
+    const QElapsedTimer &_clock;
+    int _id;
+    Stats _stats;
+  };
+  
+  qint64 percentile(const QVector<qint64> &sorted, const double p)
+  {
+    if(sorted.isEmpty()) return 0;
+    const int i = qMin(sorted.size() - 1, static_cast<int>(p * sorted.size()));
+    return sorted[i];
+  }
+}
+
+// Drives a running simulator's register server like one or more controller
+// programs would and prints the sustained throughput and round-trip latency
+// as JSON, e.g. to compare register server changes:
+//   ks2-kmod-load --clients 4 --writes 2 --duration 30 > kmod.json
+// Exits with 1 if no state request was ever answered.
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("ks2-kmod-load");
+  
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Load generator for the simulator's register server");
+  parser.addHelpOption();
+  QCommandLineOption host("host", "Simulator address.", "address", "127.0.0.1");
+  QCommandLineOption port("port", "Register server port.", "port", QString::number(KMOD_PORT));
+  QCommandLineOption clients("clients", "Concurrent clients, each with its own socket.", "n", "1");
+  QCommandLineOption writes("writes", "Register writes per packet.", "n", "1");
+  QCommandLineOption stateEvery("state-every", "Send a state request in every nth packet.", "n", "1");
+  QCommandLineOption rate("rate", "Packets per second per client; 0 busy-polls.", "hz", "0");
+  QCommandLineOption warmup("warmup", "Seconds to run before measuring.", "s", "1");
+  QCommandLineOption duration("duration", "Seconds to measure.", "s", "10");
+  QCommandLineOption timeout("timeout", "Milliseconds to wait for a state reply.", "ms", "100");
+  parser.addOption(host);
+  parser.addOption(port);
+  parser.addOption(clients);
+  parser.addOption(writes);
+  parser.addOption(stateEvery);
+  parser.addOption(rate);
+  parser.addOption(warmup);
+  parser.addOption(duration);
+  parser.addOption(timeout);
+  parser.process(app);
+  
+  Options options;
+  options.host = QHostAddress(parser.value(host));
+  options.port = parser.value(port).toUShort();
+  options.clients = qMax(1, parser.value(clients).toInt());
+  options.writes = qBound(0, parser.value(writes).toInt(), 1000);
+  options.stateEvery = qMax(1, parser.value(stateEvery).toInt());
+  options.rate = qMax(0.0, parser.value(rate).toDouble());
+  options.warmup = qMax(0.0, parser.value(warmup).toDouble());
+  options.duration = qMax(0.1, parser.value(duration).toDouble());
+  options.timeout = qMax(1, parser.value(timeout).toInt());
+  if(!options.writes && options.stateEvery > 1) {
+    QTextStream(stderr) << "Packets without writes must all carry a state request" << endl;
+    return 2;
+  }
+  
+  QElapsedTimer clock;
+  clock.start();
+  QVector<Client *> threads;
+  for(int i = 0; i < options.clients; ++i) {
+    Client *const client = new Client(options, clock, i);
+    threads.append(client);
+    client->start();
+  }
+  
+  Stats total;
+  Q_FOREACH(Client *const client, threads) {
+    client->wait();
+    const Stats &stats = client->stats();
+    total.packets += stats.packets;
+    total.writes += stats.writes;
+    total.stateRequests += stats.stateRequests;
+    total.timeouts += stats.timeouts;
+    total.latencies += stats.latencies;
+  }
+  qDeleteAll(threads);
+  std::sort(total.latencies.begin(), total.latencies.end());
+  
+  const double seconds = options.duration;
+  QTextStream out(stdout);
+  out << "{\n";
+  out << "  \"version\": \"" << SIMULATOR_VERSION_MAJOR << "." << SIMULATOR_VERSION_MINOR << "\",\n";
+  out << "  \"clients\": " << options.clients << ",\n";
+  out << "  \"writes_per_packet\": " << options.writes << ",\n";
+  out << "  \"state_every\": " << options.stateEvery << ",\n";
+  out << "  \"rate_hz\": " << options.rate << ",\n";
+  out << "  \"duration_s\": " << seconds << ",\n";
+  out << "  \"packets\": " << total.packets << ",\n";
+  out << "  \"state_requests\": " << total.stateRequests << ",\n";
+  out << "  \"timeouts\": " << total.timeouts << ",\n";
+  out << "  \"packets_per_s\": " << QString::number(total.packets / seconds, 'f', 1) << ",\n";
+  out << "  \"register_ops_per_s\": "
+    << QString::number((total.writes + total.stateRequests) / seconds, 'f', 1) << ",\n";
+  out << "  \"latency_ns\": {\"p50\": " << percentile(total.latencies, 0.5)
+    << ", \"p99\": " << percentile(total.latencies, 0.99)
+    << ", \"p99.9\": " << percentile(total.latencies, 0.999)
+    << ", \"max\": " << (total.latencies.isEmpty() ? 0 : total.latencies.last()) << "}\n";
+  out << "}\n";
+  out.flush();
+  
+  return total.latencies.isEmpty() ? 1 : 0;
+}
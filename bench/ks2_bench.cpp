@@ -0,0 +1,470 @@
+#include "board_file.hpp"
+#include "walls.hpp"
+#include "robot.hpp"
+#include "robot_sensors.hpp"
+#include "light.hpp"
+#include "kovan_kmod_sim.hpp"
+#include "kovan_regs_p.hpp"
+#include "register_readout.hpp"
+#include "simulator.hpp"
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QStringList>
+#include <QVector>
+#include <QMap>
+#include <QFile>
+#include <QDir>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Timed samples per benchmark; the median is the headline number
+#define SAMPLES 7
+// Iterations per sample are doubled until one sample takes this long
+#define DEFAULT_MIN_SAMPLE_MS 50
+
+// Keeps results alive so the measured work is not optimized away
+static volatile double sink = 0.0;
+
+namespace
+{
+  class Benchmark
+  {
+  public:
+    Benchmark(const QString &name)
+      : _name(name)
+    {
+    }
+  
+    virtual ~Benchmark()
+    {
+    }
+  
+    const QString &name() const
+    {
+      return _name;
+    }
+  
+    // Runs the measured operation iterations times
+    virtual void run(const quint64 iterations) = 0;
+  
+  private:
+    QString _name;
+  };
+  
+  struct Result
+  {
+    QString name;
+    quint64 iterations;
+    double medianNs;
+    double minNs;
+    double maxNs;
+  };
+  
+  // Deterministic so every run measures the same boards
+  class Random
+  {
+  public:
+    Random(const quint32 seed)
+      : _state(seed)
+    {
+    }
+  
+    double uniform(const double min, const double max)
+    {
+      _state = _state * 1664525u + 1013904223u;
+      return min + (max - min) * (_state / 4294967296.0);
+    }
+  
+  private:
+    quint32 _state;
+  };
+  
+  // Random short segments at about one per 10 x 10 cm, inside an outline,
+  // with every tenth segment tape. The middle is kept clear for the robot.
+  QString syntheticBoard(const quint32 segments)
+  {
+    const double side = 10.0 * std::sqrt(static_cast<double>(segments));
+    const double clear = 30.0;
+    Random random(segments);
+  
+    QString source;
+    QTextStream out(&source);
+    out << "set-units cm\n";
+    out << "line 0 0 0 " << side << "\n";
+    out << "line 0 " << side << " " << side << " " << side << "\n";
+    out << "line " << side << " " << side << " " << side << " 0\n";
+    out << "line " << side << " 0 0 0\n";
+    for(quint32 i = 4; i < segments;) {
+      const double x = random.uniform(0.0, side);
+      const double y = random.uniform(0.0, side);
+      const double angle = random.uniform(0.0, 2.0 * M_PI);
+      const double length = random.uniform(2.0, 12.0);
+      if(std::fabs(x - side / 2.0) < clear && std::fabs(y - side / 2.0) < clear) continue;
+      out << (i % 10 ? "line " : "tape ") << x << " " << y << " "
+        << x + length * std::cos(angle) << " " << y + length * std::sin(angle) << "\n";
+      ++i;
+    }
+    out.flush();
+    return source;
+  }
+  
+  // One synthetic board with its collision geometry and a robot in the middle
+  struct Fixture
+  {
+    Fixture(const quint32 segments)
+      : segments(segments)
+      , source(syntheticBoard(segments))
+      , board(BoardFile::fromSource("synthetic", source))
+      , walls(new Walls(board))
+      , robot(new Robot)
+    {
+      const QRectF bounds = board->bounds();
+      robot->setWalls(walls);
+      robot->setPosition(bounds.center());
+      robot->setRotation(30.0);
+      robot->setLeftSpeed(10.0);
+      robot->setRightSpeed(12.0);
+    }
+  
+    ~Fixture()
+    {
+      delete robot;
+      delete walls;
+      delete board;
+    }
+  
+    quint32 segments;
+    QString source;
+    BoardFile *board;
+    Walls *walls;
+    Robot *robot;
+  };
+  
+  QString withSegments(const char *const name, const Fixture *const fixture)
+  {
+    return QString("%1/%2").arg(name).arg(fixture->segments);
+  }
+  
+  class BoardParse : public Benchmark
+  {
+  public:
+    BoardParse(const Fixture *const fixture)
+      : Benchmark(withSegments("board.parse", fixture))
+      , _fixture(fixture)
+    {
+    }
+  
+    void run(const quint64 iterations)
+    {
+      for(quint64 i = 0; i < iterations; ++i) {
+        BoardFile *const board = BoardFile::fromSource("synthetic", _fixture->source);
+        sink = sink + board->lineCount();
+        delete board;
+      }
+    }
+  
+  private:
+    const Fixture *_fixture;
+  };
+  
+  class BoardLoadCompiled : public Benchmark
+  {
+  public:
+    BoardLoadCompiled(const Fixture *const fixture, const QString &directory)
+      : Benchmark(withSegments("board.load_compiled", fixture))
+      , _path(QDir(directory).filePath(QString("synthetic%1.board").arg(fixture->segments)))
+    {
+      QFile file(_path);
+      if(file.open(QIODevice::WriteOnly)) file.write(fixture->source.toUtf8());
+      file.close();
+      // Writes the compiled board every later load maps
+      delete BoardFile::load(_path);
+    }
+  
+    void run(const quint64 iterations)
+    {
+      for(quint64 i = 0; i < iterations; ++i) {
+        BoardFile *const board = BoardFile::load(_path);
+        sink = sink + board->lineCount();
+        delete board;
+      }
+    }
+  
+  private:
+    QString _path;
+  };
+  
+  class WallsBuild : public Benchmark
+  {
+  public:
+    WallsBuild(const Fixture *const fixture)
+      : Benchmark(withSegments("walls.build", fixture))
+      , _fixture(fixture)
+    {
+    }
+  
+    void run(const quint64 iterations)
+    {
+      for(quint64 i = 0; i < iterations; ++i) {
+        const Walls walls(_fixture->board);
+        sink = sink + walls.segmentCount();
+      }
+    }
+  
+  private:
+    const Fixture *_fixture;
+  };
+  
+  // The three range sensors, cast as one batch (what intersectDistance did)
+  class RobotRanges : public Benchmark
+  {
+  public:
+    RobotRanges(const Fixture *const fixture)
+      : Benchmark(withSegments("robot.ranges", fixture))
+      , _robot(fixture->robot)
+    {
+    }
+  
+    void run(const quint64 iterations)
+    {
+      for(quint64 i = 0; i < iterations; ++i) {
+        _robot->invalidateSensors();
+        sink = sink + _robot->leftRange() + _robot->frontRange() + _robot->rightRange();
+      }
+    }
+  
+  private:
+    Robot *_robot;
+  };
+  
+  class RobotReflectance : public Benchmark
+  {
+  public:
+    RobotReflectance(Fixture *const fixture)
+      : Benchmark(withSegments("robot.reflectance", fixture))
+      , _robot(fixture->robot)
+    {
+    }
+  
+    void run(const quint64 iterations)
+    {
+      for(quint64 i = 0; i < iterations; ++i) {
+        _robot->invalidateSensors();
+        sink = sink + _robot->leftReflectance() + _robot->rightReflectance();
+      }
+    }
+  
+  private:
+    Robot *_robot;
+  };
+  
+  // One 1 kHz tick of the drive, colliding with the board
+  class RobotUpdate : public Benchmark
+  {
+  public:
+    RobotUpdate(const Fixture *const fixture)
+      : Benchmark(withSegments("robot.update", fixture))
+      , _robot(fixture->robot)
+      , _start(fixture->robot->kinematics())
+    {
+    }
+  
+    void run(const quint64 iterations)
+    {
+      // Every sample drives the same path
+      _robot->setKinematics(_start);
+      for(quint64 i = 0; i < iterations; ++i) _robot->update(0.001);
+      sink = sink + _robot->position().x();
+    }
+  
+  private:
+    Robot *_robot;
+    Robot::Kinematics _start;
+  };
+  
+  // A typical controller packet: four register writes and a state request.
+  // With sensors, every packet is treated as the first one of a new tick.
+  class KmodProcess : public Benchmark
+  {
+  public:
+    KmodProcess(const QString &name, RobotSensors *const sensors, Robot *const robot)
+      : Benchmark(name)
+      , _sensors(sensors)
+      , _robot(robot)
+    {
+      _kmod.setSensorProvider(sensors);
+  
+      const int commands = 5;
+      _datagram.fill(0, sizeof(Kovan::Packet) + (commands - 1) * sizeof(Kovan::Command));
+      Kovan::Packet *const packet = reinterpret_cast<Kovan::Packet *>(_datagram.data());
+      packet->num = commands;
+      static const unsigned short addresses[4] = { MOTOR_PWM_0, MOTOR_PWM_1, SERVO_COMMAND_0, DIG_OUT };
+      for(int i = 0; i < 4; ++i) {
+        Kovan::WriteCommand write;
+        write.addy = addresses[i];
+        write.val = 100 * (i + 1);
+        packet->commands[i].type = Kovan::WriteCommandType;
+        memcpy(packet->commands[i].data, &write, sizeof(write));
+      }
+      packet->commands[4].type = Kovan::StateCommandType;
+    }
+  
+    ~KmodProcess()
+    {
+      _kmod.setSensorProvider(0);
+    }
+  
+    void run(const quint64 iterations)
+    {
+      for(quint64 i = 0; i < iterations; ++i) {
+        if(_sensors) {
+          _robot->invalidateSensors();
+          _sensors->invalidate();
+        }
+        const Kovan::StateResponse response = _kmod.process(_datagram);
+        sink = sink + response.state.t[AN_IN_0];
+      }
+    }
+  
+  private:
+    RobotSensors *_sensors;
+    Robot *_robot;
+    Kovan::KmodSim _kmod;
+    QByteArray _datagram;
+  };
+  
+  // The register copy MainWindow::update does under the kmod lock
+  class RegisterFill : public Benchmark
+  {
+  public:
+    RegisterFill()
+      : Benchmark("gui.register_readout")
+    {
+      for(int i = 0; i < TOTAL_REGS; ++i) _state.t[i] = i * 37;
+    }
+  
+    void run(const quint64 iterations)
+    {
+      RegisterReadout readout;
+      for(quint64 i = 0; i < iterations; ++i) {
+        _state.t[DIG_IN] = i;
+        readout.read(_state);
+        sink = sink + readout.analogs[i & 7] + readout.digitals[i & 7];
+      }
+    }
+  
+  private:
+    Kovan::State _state;
+  };
+  
+  double elapsedNs(Benchmark *const benchmark, const quint64 iterations)
+  {
+    QElapsedTimer timer;
+    timer.start();
+    benchmark->run(iterations);
+    return timer.nsecsElapsed();
+  }
+  
+  Result measure(Benchmark *const benchmark, const qint64 minSampleNs)
+  {
+    // Calibrate (which also warms up) until one sample is long enough
+    quint64 iterations = 1;
+    while(elapsedNs(benchmark, iterations) < minSampleNs && iterations < (Q_UINT64_C(1) << 40)) {
+      iterations *= 2;
+    }
+  
+    QVector<double> perOp;
+    for(int i = 0; i < SAMPLES; ++i) perOp.append(elapsedNs(benchmark, iterations) / iterations);
+    std::sort(perOp.begin(), perOp.end());
+  
+    Result result;
+    result.name = benchmark->name();
+    result.iterations = iterations;
+    result.medianNs = perOp[SAMPLES / 2];
+    result.minNs = perOp.first();
+    result.maxNs = perOp.last();
+    return result;
+  }
+}
+
+// Prints one JSON document with the median, fastest and slowest time per
+// operation of every benchmark, e.g. to archive next to each release:
+//   ks2-bench [--filter <substring>] [--min-time <ms>] > bench.json
+int main(int argc, char *argv[])
+{
+  // The robot and boards are graphics items; no window is ever shown
+  if(qgetenv("QT_QPA_PLATFORM").isEmpty()) qputenv("QT_QPA_PLATFORM", "offscreen");
+  QApplication app(argc, argv);
+  
+  QString filter;
+  qint64 minSampleNs = DEFAULT_MIN_SAMPLE_MS * 1000000LL;
+  const QStringList args = app.arguments();
+  for(int i = 1; i < args.size(); ++i) {
+    if(args[i] == "--filter" && i + 1 < args.size()) filter = args[++i];
+    else if(args[i] == "--min-time" && i + 1 < args.size()) minSampleNs = args[++i].toLongLong() * 1000000LL;
+    else {
+      QTextStream(stderr) << "usage: ks2-bench [--filter <substring>] [--min-time <ms>]" << endl;
+      return 1;
+    }
+  }
+  
+  QTemporaryDir directory;
+  
+  static const quint32 sizes[3] = { 10000, 30000, 100000 };
+  QVector<Fixture *> fixtures;
+  QVector<Benchmark *> benchmarks;
+  for(int i = 0; i < 3; ++i) {
+    Fixture *const fixture = new Fixture(sizes[i]);
+    fixtures.append(fixture);
+    benchmarks.append(new BoardParse(fixture));
+    benchmarks.append(new BoardLoadCompiled(fixture, directory.path()));
+    benchmarks.append(new WallsBuild(fixture));
+    benchmarks.append(new RobotRanges(fixture));
+    benchmarks.append(new RobotReflectance(fixture));
+    benchmarks.append(new RobotUpdate(fixture));
+  }
+  
+  // The register engine alone, and with every sensor routed to a register
+  Light light;
+  light.setOn(true);
+  RobotSensors sensors(fixtures.first()->robot, &light);
+  QMap<int, int> analogs;
+  for(int i = 0; i < RobotSensors::AnalogRoleCount; ++i) analogs[i] = i;
+  QMap<int, int> digitals;
+  for(int i = 0; i < RobotSensors::DigitalRoleCount; ++i) digitals[i] = i;
+  sensors.setAnalogMapping(analogs);
+  sensors.setDigitalMapping(digitals);
+  benchmarks.append(new KmodProcess("kmod.process", 0, 0));
+  benchmarks.append(new KmodProcess("kmod.process_sampled", &sensors, fixtures.first()->robot));
+  benchmarks.append(new RegisterFill);
+  
+  QTextStream out(stdout);
+  out << "{\n";
+  out << "  \"version\": \"" << SIMULATOR_VERSION_MAJOR << "." << SIMULATOR_VERSION_MINOR << "\",\n";
+  out << "  \"qt\": \"" << qVersion() << "\",\n";
+  out << "  \"samples\": " << SAMPLES << ",\n";
+  out << "  \"results\": [";
+  bool first = true;
+  Q_FOREACH(Benchmark *const benchmark, benchmarks) {
+    if(!filter.isEmpty() && !benchmark->name().contains(filter)) continue;
+  
+    QTextStream(stderr) << benchmark->name() << endl;
+    const Result result = measure(benchmark, minSampleNs);
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "    {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+      << ", \"median_ns\": " << QString::number(result.medianNs, 'f', 1)
+      << ", \"min_ns\": " << QString::number(result.minNs, 'f', 1)
+      << ", \"max_ns\": " << QString::number(result.maxNs, 'f', 1) << "}";
+  }
+  out << "\n  ]\n}\n";
+  out.flush();
+  
+  qDeleteAll(benchmarks);
+  qDeleteAll(fixtures);
+  return 0;
+}
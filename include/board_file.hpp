@@ -3,8 +3,19 @@
 
 #include <QString>
 #include <QObject>
+#include <QVector>
+#include <QLineF>
+#include <QRectF>
+#include <QRgb>
+#include <QImage>
 
 class QGraphicsScene;
+class QPainter;
+class QPen;
+class QBrush;
+class QFile;
+class QFileInfo;
+class QGraphicsItem;
 
 class BoardFile : public QObject
 {
@@ -17,23 +28,147 @@ public:
     Fake
   };
   
+  // The records below are stored as-is in compiled boards, so their layout
+  // must not change without bumping the compiled format version
+  struct Style
+  {
+    enum { HasBrush = 0x1 };
+  
+    QRgb pen;
+    quint32 penWidth;
+    QRgb brush;
+    quint32 flags;
+  };
+  
+  struct Line
+  {
+    double x1;
+    double y1;
+    double x2;
+    double y2;
+    double z;
+    quint32 type;
+    quint32 style;
+  
+    QLineF line() const { return QLineF(x1, y1, x2, y2); }
+  };
+  
+  struct Rect
+  {
+    double x;
+    double y;
+    double w;
+    double h;
+    double z;
+    quint32 style;
+    quint32 reserved;
+  
+    QRectF rect() const { return QRectF(x, y, w, h); }
+  };
+  
+  // Uniform grid over the board bounds. Cell i holds the line indices
+  // items[start[i]] .. items[start[i + 1]] of every line touching it.
+  struct Grid
+  {
+    double x;
+    double y;
+    double cellSize;
+    quint32 columns;
+    quint32 rows;
+    const quint32 *start;
+    const quint32 *items;
+  };
+  
   BoardFile(QObject *const parent = 0);
+  ~BoardFile();
   
+  // Loads the compiled board next to path if it is up to date, otherwise
+  // parses the source and (re)writes the compiled board. Safe to call from
+  // any thread; the scene is only built when first requested.
   static BoardFile *load(const QString &path);
+  static QString compiledPath(const QString &path);
+  
+  // Parses board source from memory, without reading or writing any file
+  static BoardFile *fromSource(const QString &name, const QString &contents);
   
   Q_PROPERTY(QString name READ name)
   const QString &name() const;
   
+  Q_PROPERTY(QString path READ path)
+  const QString &path() const;
+  
+  bool isCompiled() const;
+  
+  const Style *styles() const;
+  quint32 styleCount() const;
+  const Line *lines() const;
+  quint32 lineCount() const;
+  const Rect *rects() const;
+  quint32 rectCount() const;
+  const Grid &grid() const;
+  QRectF bounds() const;
+  
+  // Paints the geometry without a scene, e.g. for thumbnails off the GUI thread
+  void render(QPainter *painter, const QRectF &target) const;
+  QImage thumbnail(const QSize &size) const;
+  
+  // Approximate heap footprint in bytes, including the scene once built
+  quint64 memoryUse() const;
+  
   Q_PROPERTY(QGraphicsScene *scene READ scene)
   const QGraphicsScene *scene() const;
   QGraphicsScene *scene();
   
+  // Takes over the geometry of a newer parse of the same file. If the scene
+  // has been built, only the items that were added, removed or restyled
+  // are touched, so views of the scene stay valid.
+  void merge(const BoardFile &other);
+  
 private:
-  static void parse(const QString &contents, QGraphicsScene *scene);
+  QByteArray shapeKey(const quint32 order) const;
+  QGraphicsItem *createItem(const quint32 order) const;
+  void parse(const QString &contents);
+  void buildGrid();
+  bool map(const QString &compiled, const QFileInfo &source);
+  bool save(const QString &compiled, const QFileInfo &source) const;
+  void buildScene();
+  QPen pen(const quint32 style) const;
+  QBrush brush(const quint32 style) const;
   static void error(const quint32 &line, const QString &id);
   static void error(const quint32 &line, const quint16 &expecting, const quint16 &got);
   
   QString _name;
+  QString _path;
+  QRectF _bounds;
+  
+  // Parse order of every shape; rect indices are tagged with RectOrder
+  enum { RectOrder = 0x80000000 };
+  
+  // Views used by every accessor. They point either into the vectors below
+  // (parsed boards) or straight into the mapped compiled file.
+  const Style *_styles;
+  const Line *_lines;
+  const Rect *_rects;
+  const quint32 *_order;
+  quint32 _styleCount;
+  quint32 _lineCount;
+  quint32 _rectCount;
+  quint32 _orderCount;
+  Grid _grid;
+  
+  QVector<Style> _styleData;
+  QVector<Line> _lineData;
+  QVector<Rect> _rectData;
+  QVector<quint32> _orderData;
+  QVector<quint32> _cellStartData;
+  QVector<quint32> _cellItemData;
+  
+  // Scene item for each entry of _order, once the scene is built
+  QVector<QGraphicsItem *> _items;
+  
+  QFile *_mapped;
+  qint64 _mappedSize;
+  
   QGraphicsScene *_scene;
 };
 
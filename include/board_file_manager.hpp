@@ -3,30 +3,112 @@
 
 #include <QObject>
 #include <QList>
+#include <QMap>
+#include <QSet>
+#include <QHash>
 #include <QStringList>
+#include <QDateTime>
+#include <QRectF>
+#include <QImage>
+#include <QThreadPool>
+#include <QFileSystemWatcher>
+#include <QTimer>
 
 class BoardFile;
 
 class BoardFileManager : public QObject
 {
+Q_OBJECT
 public:
+  // Lightweight description of a board file; bounds and thumbnail are
+  // filled in by a background job once the file has been indexed
+  struct Entry
+  {
+    QString name;
+    QString path;
+    QDateTime modified;
+    QRectF bounds;
+    QImage thumbnail;
+    bool indexed;
+  };
+  
   BoardFileManager(QObject *const parent = 0);
   ~BoardFileManager();
   
-  void addBoardFile(BoardFile *const file);
-  bool removeBoardFile(BoardFile *const file);
+  const QList<Entry> &entries() const;
+  const Entry *lookupEntry(const QString &name) const;
+  
+  // Returns the parsed board if it has already been loaded
+  BoardFile *lookupBoardFile(const QString &name) const;
+  
+  // Parses the named board in the background; boardLoaded() is emitted
+  // once it is available (immediately if it already is). Receivers that
+  // hold on to the board must retain() it and release() it when done.
+  bool requestBoardFile(const QString &name);
   
-  const QList<BoardFile *> &boardFiles() const;
+  void retain(BoardFile *const board);
+  void release(BoardFile *const board);
   
-  BoardFile *lookupBoardFile(const QString &name);
+  // Unreferenced boards are evicted, least recently used first, while the
+  // cache is over budget. Superseded boards are freed once unreferenced.
+  void setMemoryBudget(const quint64 bytes);
+  quint64 memoryBudget() const;
+  quint64 memoryUse() const;
   
   void addLocation(const QString &path);
-  quint32 loadLocation(const QString &path);
   
+  // Directory for the persistent thumbnail cache, keyed by board path and
+  // content hash. Thumbnails are only kept in memory if this is empty.
+  void setThumbnailPath(const QString &path);
+  const QString &thumbnailPath() const;
+  
+  // Rescans every location. Only file metadata is read here. Boards that
+  // are in use and changed on disk are re-parsed and merged in place.
+  // Called automatically shortly after a watched location or board changes.
   void reload();
+  
+Q_SIGNALS:
+  void catalogChanged();
+  void entryIndexed(const QString &name);
+  void boardLoaded(BoardFile *board);
+  // A board that is in use was merged with its changed file
+  void boardChanged(BoardFile *board);
+  
+private Q_SLOTS:
+  void indexed(const QString &path, const QDateTime &modified, const QRectF &bounds, const QImage &thumbnail);
+  void parsed(const QString &path, const QDateTime &modified, BoardFile *board);
+  void reparsed(const QString &path, const QDateTime &modified, BoardFile *board);
+  
 private:
-  QList<BoardFile *> _boards;
+  struct CacheEntry
+  {
+    QDateTime modified;
+    quint32 refs;
+    quint64 lastUsed;
+  };
+  
+  int indexOf(const QString &path) const;
+  void supersede(const QString &path);
+  void watch();
+  void destroy(BoardFile *const board);
+  void trim();
+  
+  QList<Entry> _entries;
   QStringList _locations;
+  QString _thumbnailPath;
+  
+  // Current board for each path, and every board we own including
+  // superseded ones that are still referenced
+  QMap<QString, BoardFile *> _boards;
+  QHash<BoardFile *, CacheEntry> _cache;
+  quint64 _budget;
+  quint64 _clock;
+  QSet<QString> _pending;
+  QSet<QString> _indexing;
+  QThreadPool _pool;
+  
+  QFileSystemWatcher _watcher;
+  QTimer _reloadTimer;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -10,27 +10,28 @@ namespace Ui
 }
 
 class BoardFile;
+class BoardFileManager;
 
 class BoardSelectorDialog : public QDialog
 {
 Q_OBJECT
 public:
-  BoardSelectorDialog(QWidget *const parent = 0);
+  BoardSelectorDialog(BoardFileManager *const manager, QWidget *const parent = 0);
   ~BoardSelectorDialog();
   
-  Q_PROPERTY(QList<BoardFile *> boardFiles READ boardFiles WRITE setBoardFiles)
-  void setBoardFiles(const QList<BoardFile *> &boardFiles);
-  const QList<BoardFile *> &boardFiles() const;
-  
-  BoardFile *selectedBoardFile() const;
+  QString selectedBoardName() const;
   
 private Q_SLOTS:
+  void catalogChanged();
+  void entryIndexed(const QString &name);
+  void boardLoaded(BoardFile *board);
   void currentChanged(const QModelIndex &index);
   
 private:
   Ui::BoardSelectorDialog *ui;
-  QList<BoardFile *> _boards;
+  BoardFileManager *_manager;
+  BoardFile *_preview;
   QStandardItemModel *_model;
 };
 
-#endif
\ No newline at end of file
+#endif
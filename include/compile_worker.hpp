@@ -25,6 +25,10 @@ public:
 	
 	void cleanup();
 	
+	// The stages run() goes through, in order; public so each can be timed
+	bool extract();
+	Compiler::OutputList compileExtracted();
+	
 private:
 	
 	Compiler::OutputList compile();
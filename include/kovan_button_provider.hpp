@@ -4,13 +4,15 @@
 #include <QObject>
 
 #include "button.hpp"
+#include "kovan_kmod_sim.hpp"
 
 namespace Kovan
 {
 	class Button;
-	class KmodSim;
 	
-	class ButtonProvider : public QObject
+	// Follows the button texts and extra buttons the controller sets, as
+	// the controller changes them
+	class ButtonProvider : public QObject, public RegisterObserver
 	{
 	Q_OBJECT
 	public:
@@ -21,15 +23,21 @@ namespace Kovan
 		virtual QString text(::Button::Type::Id id) const;
 		virtual bool setPressed(::Button::Type::Id id, bool pressed);
 		
+		virtual void registerChanged(Event event, unsigned short address, unsigned short value);
+		
 	public slots:
 		virtual void reset();
 		virtual void refresh();
+		// Re-emits every text and the extra buttons' visibility, for when the
+		// registers were replaced behind the controller's back
+		virtual void refreshAll();
 	
 	signals:
 		void buttonTextChanged(::Button::Type::Id id, const QString& text);
 		void extraShownChanged(const bool& shown);
 	
 	private:
+		KmodSim *m_sim;
 		Button m_button;
 		bool m_extraShown;
 	};
@@ -21,19 +21,63 @@
 
 #include <QObject>
 #include <QTime>
+#include <QMutex>
+#include <QList>
+#include <QHostAddress>
+#include <QElapsedTimer>
 
 #include "kovan_protocol_p.hpp"
+#include "kovan_motor_sim.hpp"
 
 class QUdpSocket;
+class QTimer;
 
 namespace Kovan
 {
 	struct StateResponse
 	{
 		unsigned char hasState : 1;
+		// Set instead of hasState when the reply is to be held back until
+		// wait is over
+		unsigned char hasWait : 1;
+		WaitCommand wait;
 		Kovan::State state;
 	};
 
+	class SensorProvider
+	{
+	public:
+		virtual ~SensorProvider() {}
+		
+		// Called right before the register file is served to the controller
+		virtual void sample(State &state) = 0;
+	};
+
+	// Told about register writes from the controller that change a watched
+	// register, instead of scanning the register file for changes
+	class RegisterObserver
+	{
+	public:
+		// What the written register controls
+		enum Event
+		{
+			ButtonText = 0, // BUTTON_TEXT_DIRTY and the button text registers
+			ButtonStates,
+			PidMode,
+			MotorPwm, // MOTOR_PWM_* and MOTOR_DRIVE_CODE_T
+			ServoCommand,
+			OtherRegister
+		};
+		
+		virtual ~RegisterObserver() {}
+		
+		// Called once the whole datagram has been processed, on the thread
+		// that processed it and without KmodSim::mutex() held
+		virtual void registerChanged(Event event, unsigned short address, unsigned short value) = 0;
+	};
+
+	class TrafficLog;
+
 	class KmodSim : public QObject
 	{
 	Q_OBJECT
@@ -47,21 +91,104 @@ namespace Kovan
 		
 		unsigned short servoValue(const unsigned char &port) const;
 		void setMotorCounter(unsigned char port, int value);
+		
+		// Motor outputs of a register channel, in [-1, 1] and wheel revolutions per second
+		double motorOutput(unsigned char port) const;
+		double motorSpeed(unsigned char port) const;
+		
+		// Advances every motor model by dt seconds. The caller must hold mutex().
+		void step(double dt);
+		
+		// Copy the register file and motor models out of and back into the
+		// simulator. The caller must hold mutex().
+		void save(State &state, MotorSim *motors) const;
+		void restore(const State &state, const MotorSim *motors);
+		
+		void setSensorProvider(SensorProvider *sensors);
+		SensorProvider *sensorProvider() const;
+	
+		// Records every datagram, register write, sensor sample, response and
+		// motor step into log until set back to 0. The log starts with the
+		// current register file and motors, so it can be replayed on its own.
+		void setTrafficLog(TrafficLog *log);
+		TrafficLog *trafficLog() const;
+		
+		// Runs one datagram through the register engine, as if it had been
+		// received from the controller, then notifies register observers
+		StateResponse process(const QByteArray &datagram);
+		
+		// Observers must be removed before they are destroyed
+		void addRegisterObserver(unsigned short address, RegisterObserver *observer);
+		void removeRegisterObserver(RegisterObserver *observer);
+		static RegisterObserver::Event registerEvent(unsigned short address);
+		
+		// Answers held wait commands whose registers have changed or whose
+		// time is up, sampling the sensors first. Called after every
+		// simulation tick; the caller must hold mutex(). The replies are
+		// sent from the thread this lives in.
+		void serviceWaits();
 	
 		Kovan::State &state();
+		
+		// Guards the register file, motor models and sensor provider against
+		// the simulation thread
+		QMutex *mutex() const;
 	
 	private slots:
 		void readyRead();
+		void answerWaits();
 	
 	signals:
 		void stateChanged(const State &state);
 	
 	private:
+		// A wait command whose reply is held back
+		struct Wait
+		{
+			QHostAddress sender;
+			quint16 senderPort;
+			WaitCommand command;
+			qint64 deadline;
+		};
+		
+		struct Reply
+		{
+			QHostAddress sender;
+			quint16 senderPort;
+			State state;
+		};
+	
 		StateResponse do_packet(const QByteArray &datagram);
+		void logRestore();
+		void logChanges(const int type, const State &before);
+		// Moves finished waits to m_replies; true if any replies are pending.
+		// The caller must hold mutex().
+		bool collectWaits(const bool sample);
 	
 		QUdpSocket *m_socket;
 	
 		Kovan::State m_state;
+		SensorProvider *m_sensors;
+		
+		TrafficLog *m_log;
+		// Register file as of the last record, to catch writes made behind
+		// the engine's back
+		Kovan::State m_logged;
+		
+		MotorSim m_motors[4];
+		mutable QMutex m_mutex;
+		
+		QList<RegisterObserver *> m_observers[TOTAL_REGS];
+		// Writes to watched registers that changed them, while processing
+		QList<WriteCommand> m_changes;
+		
+		// Guarded by mutex(), as the simulation thread checks them
+		QList<Wait> m_waits;
+		QList<Reply> m_replies;
+		bool m_answerQueued;
+		// Fires at the earliest wait's deadline
+		QTimer *m_waitTimer;
+		QElapsedTimer m_clock;
 	};
 }
 
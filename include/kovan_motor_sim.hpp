@@ -0,0 +1,66 @@
+/**************************************************************************
+ * ks2 - A 2D simulator for the Kovan Robot Controller                    *
+ * Copyright (C) 2012 KISS Institute for Practical Robotics               *
+ *                                                                        *
+ * This program is free software: you can redistribute it and/or modify   *
+ * it under the terms of the GNU General Public License as published by   *
+ * the Free Software Foundation, either version 3 of the License, or      *
+ * (at your option) any later version.                                    *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ **************************************************************************/
+
+#ifndef _KOVAN_MOTOR_SIM_HPP_
+#define _KOVAN_MOTOR_SIM_HPP_
+
+#include "kovan_protocol_p.hpp"
+
+// One BEMF tick is a thousandth of a wheel revolution
+#define MOTOR_TICKS_PER_REV 1000.0
+// Free running speed of a motor at full duty, in ticks per second
+#define MOTOR_MAX_SPEED 2500.0
+// Mechanical time constant of the motor, in seconds
+#define MOTOR_TIME_CONSTANT 0.05
+// Position error (in ticks) below which a position goal is considered reached
+#define MOTOR_GOAL_EPSILON 20
+
+namespace Kovan
+{
+	// Simulates a single motor channel: the PWM/PID command registers drive a
+	// first order motor whose integrated position is reported as BEMF ticks.
+	class MotorSim
+	{
+	public:
+		MotorSim();
+		
+		void reset();
+		void clearCounter();
+		
+		// Advances the motor by dt seconds using the command registers of channel
+		void step(const State &state, unsigned char channel, double dt);
+		
+		int counter() const;
+		double velocity() const;
+		double output() const;
+		bool isActive() const;
+		
+	private:
+		double targetVelocity(const State &state, unsigned char channel, double dt);
+		static double gain(const State &state, int num, int den, double fallback);
+		
+		double m_position;
+		double m_velocity;
+		double m_output;
+		
+		double m_integral;
+		bool m_active;
+	};
+}
+
+#endif
@@ -8,6 +8,7 @@ extern "C" {
 #define MAX_COMMAND_DATA_SIZE 16
 #define NUM_FPGA_REGS 48
 #define TOTAL_REGS 200
+#define MAX_WAIT_REGISTERS 3
 
 
 namespace Kovan
@@ -16,7 +17,8 @@ namespace Kovan
 	{
 		NilType = 0,
 		StateCommandType,
-		WriteCommandType
+		WriteCommandType,
+		WaitCommandType
 	};
 
 	struct Command
@@ -37,6 +39,16 @@ namespace Kovan
 		unsigned short val; // 0 - 0xFFFF
 	};
 
+	// Answered with the state like a state request, but only once one of
+	// the registers no longer holds the given value or timeout milliseconds
+	// have passed. Lets a polling loop sleep instead of spin.
+	struct WaitCommand
+	{
+		unsigned short timeout;
+		unsigned short count;
+		struct WriteCommand registers[MAX_WAIT_REGISTERS];
+	};
+
 	struct State
 	{
 		unsigned short t[TOTAL_REGS];
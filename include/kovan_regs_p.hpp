@@ -131,4 +131,10 @@
 #define BUTTON_Z_TEXT_START 	137
 #define BUTTON_Z_TEXT_END 	145
 
+// Simulator only: scanning rangefinder beams, scaled like the analog range
+// sensors, in the registers the hardware leaves unused
+#define SCAN_BEAM_COUNT 	146
+#define SCAN_RANGE_START 	147
+#define SCAN_RANGE_END 	199
+
 #endif
@@ -0,0 +1,129 @@
+/**************************************************************************
+ * ks2 - A 2D simulator for the Kovan Robot Controller                    *
+ * Copyright (C) 2012 KISS Institute for Practical Robotics               *
+ *                                                                        *
+ * This program is free software: you can redistribute it and/or modify   *
+ * it under the terms of the GNU General Public License as published by   *
+ * the Free Software Foundation, either version 3 of the License, or      *
+ * (at your option) any later version.                                    *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ **************************************************************************/
+
+#ifndef _KOVAN_TRAFFIC_LOG_HPP_
+#define _KOVAN_TRAFFIC_LOG_HPP_
+
+#include <QFile>
+#include <QElapsedTimer>
+
+namespace Kovan
+{
+	// Append-only binary log of everything that reaches a KmodSim's register
+	// file. Records are copied straight into a memory mapping of the file,
+	// which grows in large chunks, so appending costs a memcpy and never waits
+	// on the disk.
+	//
+	// The file is a FileHeader followed by records, each a RecordHeader and
+	// its payload padded to 8 bytes. Space that was never written reads as an
+	// EndRecord, so the log of a crashed run is still readable.
+	class TrafficLog
+	{
+	public:
+		enum RecordType
+		{
+			EndRecord = 0,
+			// The datagram as received from the controller
+			DatagramRecord,
+			// WriteCommands the datagram applied, in order
+			WritesRecord,
+			// Registers the sensor provider changed, as WriteCommands
+			SensorsRecord,
+			// The State served to the controller
+			ResponseRecord,
+			// Motor step; the payload is dt in seconds as a double
+			StepRecord,
+			// Registers changed outside of packets and steps (e.g. the
+			// buttons), as WriteCommands
+			ExternalRecord,
+			// The register file and four motor models, replaced wholesale
+			RestoreRecord
+		};
+		
+		struct FileHeader
+		{
+			quint32 magic;
+			quint32 version;
+			// Size of State and MotorSim when written; replay needs both to match
+			quint32 stateSize;
+			quint32 motorSize;
+		};
+		
+		struct RecordHeader
+		{
+			quint32 type;
+			quint32 size;
+			// Nanoseconds since the log was opened
+			qint64 time;
+		};
+		
+		enum
+		{
+			Magic = 0x4C54534B,
+			Version = 1
+		};
+		
+		TrafficLog();
+		~TrafficLog();
+		
+		// Creates (or truncates) path and starts a new log in it
+		bool open(const QString &path);
+		void close();
+		bool isOpen() const;
+		
+		QString fileName() const;
+		
+		// Bytes written so far, headers included
+		quint64 size() const;
+		
+		// Not thread safe; KmodSim only appends under its mutex
+		void append(const RecordType type, const void *data, const quint32 size);
+		
+	private:
+		bool reserve(const quint64 size);
+		
+		QFile m_file;
+		uchar *m_data;
+		quint64 m_size;
+		quint64 m_capacity;
+		QElapsedTimer m_clock;
+	};
+	
+	// Walks the records of a log written by TrafficLog
+	class TrafficLogReader
+	{
+	public:
+		TrafficLogReader();
+		~TrafficLogReader();
+		
+		bool open(const QString &path);
+		void close();
+		
+		// Fills header and points payload at the next record. Returns false at
+		// the end of the log, or if the rest of the log is truncated.
+		bool next(TrafficLog::RecordHeader &header, const uchar *&payload);
+		
+	private:
+		QFile m_file;
+		const uchar *m_data;
+		quint64 m_size;
+		quint64 m_offset;
+	};
+}
+
+#endif
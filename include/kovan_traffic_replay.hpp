@@ -0,0 +1,70 @@
+/**************************************************************************
+ * ks2 - A 2D simulator for the Kovan Robot Controller                    *
+ * Copyright (C) 2012 KISS Institute for Practical Robotics               *
+ *                                                                        *
+ * This program is free software: you can redistribute it and/or modify   *
+ * it under the terms of the GNU General Public License as published by   *
+ * the Free Software Foundation, either version 3 of the License, or      *
+ * (at your option) any later version.                                    *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ **************************************************************************/
+
+#ifndef _KOVAN_TRAFFIC_REPLAY_HPP_
+#define _KOVAN_TRAFFIC_REPLAY_HPP_
+
+#include <QString>
+
+#include "kovan_kmod_sim.hpp"
+
+namespace Kovan
+{
+	// Feeds a traffic log back through a fresh register engine, without the
+	// controller, the robot or a socket. Sensor samples come from the log, so
+	// a replay is deterministic and every state response can be compared
+	// against the recorded one.
+	class TrafficReplay : public SensorProvider
+	{
+	public:
+		struct Result
+		{
+			quint64 datagrams;
+			quint64 steps;
+			quint64 responses;
+			// Responses that differ from the recording
+			quint64 divergences;
+			// Log time of the first divergent response and its first differing
+			// register, or -1
+			qint64 firstDivergenceNs;
+			int firstDivergentRegister;
+			// Length of the recording and time spent inside the register engine
+			qint64 recordedNs;
+			qint64 engineNs;
+		};
+		
+		TrafficReplay();
+		
+		bool run(const QString &path, Result &result);
+		
+		virtual void sample(State &state);
+		
+	private:
+		void flush(KmodSim &sim, Result &result);
+		
+		// The datagram being replayed and the records it produced
+		const uchar *m_datagram;
+		quint32 m_datagramSize;
+		qint64 m_datagramTime;
+		const WriteCommand *m_sensors;
+		quint32 m_sensorCount;
+		const State *m_response;
+	};
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define _LIGHT_HPP_
 
 #include <QGraphicsEllipseItem>
+#include <QMutex>
 
 class Light : public QGraphicsEllipseItem
 {
@@ -14,7 +15,12 @@ public:
 	void toggle();
 	void setOn(bool on);
 	
+	// Position and state as last set on the GUI thread; safe to call from
+	// any thread
+	void sensorState(QPointF &pos, bool &on) const;
+	
 protected:
+	virtual QVariant itemChange(GraphicsItemChange change, const QVariant &value);
 	virtual void mousePressEvent(QGraphicsSceneMouseEvent *event);
 	virtual void mouseMoveEvent(QGraphicsSceneMouseEvent *event);
 	virtual void mouseReleaseEvent(QGraphicsSceneMouseEvent *event);
@@ -25,6 +31,10 @@ private:
 	
 	bool m_on;
 	QGraphicsEllipseItem *m_gradient;
+	
+	mutable QMutex m_stateMutex;
+	QPointF m_statePos;
+	bool m_stateOn;
 };
 
 #endif
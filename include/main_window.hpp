@@ -23,7 +23,9 @@
 #include <QMap>
 
 #include "button_ids.hpp"
+#include "kovan_kmod_sim.hpp"
 #include "board_file_manager.hpp"
+#include "world_snapshot.hpp"
 
 namespace Ui
 {
@@ -38,27 +40,41 @@ class Light;
 class Heartbeat;
 class ServerThread;
 class MappingModel;
+class RobotSensors;
+class Walls;
+class SimulationThread;
+class Telemetry;
+class MetricsServer;
 class QTimer;
+class QGraphicsScene;
 
 namespace Kovan
 {
-	class KmodSim;
 	class ButtonProvider;
+	class TrafficLog;
 }
 
-class MainWindow : public QMainWindow
+class MainWindow : public QMainWindow, public Kovan::RegisterObserver
 {
 Q_OBJECT
 public:
 	MainWindow(QWidget *parent = 0);
 	~MainWindow();
 	
+	virtual void registerChanged(Event event, unsigned short address, unsigned short value);
+	
 private slots:
 	void buttonPressed();
 	void buttonReleased();
 	void textChanged(::Button::Type::Id id, const QString &text);
 	void update();
 	void reset();
+	void saveCheckpoint();
+	void restoreCheckpoint();
+	void recordTraffic(bool record);
+	void recordTelemetry(bool record);
+	void trace(bool enabled);
+	void saveTrace();
 	
 	void finished(int exitCode);
 	
@@ -69,6 +85,8 @@ private slots:
   void configPorts();
   
   void updateBoard();
+  void boardLoaded(BoardFile *board);
+  void boardChanged(BoardFile *board);
   void selectBoard();
   void newBoard(const QString &board);
   
@@ -79,26 +97,52 @@ private slots:
 private:
 	void updateAdvert();
 	int unfixPort(int port);
-	void setDigital(int port, bool on);
+	void setServo(const int channel, const unsigned short command);
+	// Brings the servo dials in line with registers set behind the controller's back
+	void syncServos();
+	
+	// Copies the whole world out of and back into the simulation. A
+	// snapshot of another board is applied once that board has loaded.
+	WorldSnapshot saveWorld() const;
+	void restoreWorld(const WorldSnapshot &snapshot);
+	
+  QString currentBoardName() const;
+  void setMotorMapping(const QMap<int, int> &mapping);
   
   BoardFileManager _boardFileManager;
+  BoardFile *_board;
+  // Name of the board updateBoard() is waiting for, if any
+  QString _requestedBoard;
+  Walls *_walls;
+  
+  WorldSnapshot _start;
+  WorldSnapshot _checkpoint;
+  WorldSnapshot _pendingWorld;
+  bool _worldPending;
 	
 	Ui::MainWindow *ui;
+  
+  // Holds only the moving items; the board is drawn as the view's background
+  QGraphicsScene *_scene;
 	
   MappingModel *_analogs;
   MappingModel *_digitals;
-  QMap<int, int> _motors;
 	TouchDial *m_motors[4];
 	TouchDial *m_servos[4];
 	Robot *m_robot;
 	Light *m_light;
+  RobotSensors *_sensors;
+  SimulationThread *_simulation;
+  Telemetry *_telemetry;
 	
 	ServerThread *m_server;
 	
 	Kovan::ButtonProvider *m_buttonProvider;
 	Kovan::KmodSim *m_kmod;
+	Kovan::TrafficLog *m_trafficLog;
 	
 	Heartbeat *m_heartbeat;
+	MetricsServer *m_metrics;
 	
 	QProcess *m_process;
   
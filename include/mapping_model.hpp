@@ -1,9 +1,12 @@
 #ifndef _MAPPING_MODEL_HPP_
 #define _MAPPING_MODEL_HPP_
 
-#include <QStandardItemModel>
+#include <QAbstractTableModel>
+#include <QStringList>
+#include <QVector>
+#include <QMap>
 
-class MappingModel : public QStandardItemModel
+class MappingModel : public QAbstractTableModel
 {
   Q_OBJECT
 public:
@@ -12,14 +15,27 @@ public:
   
   void setValue(const int port, const int value);
   
+  // Updates every mapped port from values indexed by port, emitting a
+  // single dataChanged() covering the rows that actually changed
+  void setValues(const int *const values, const int count);
+  
   void setMapping(const QMap<int, int> &map, const QStringList &roles, const int offset = 0);
   const QMap<int, int> &mapping() const;
   const QStringList &roles() const;
   
+  virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
+  virtual int columnCount(const QModelIndex &parent = QModelIndex()) const;
+  virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+  virtual QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+  
 private:
   QMap<int, int> _map;
   int _offset;
   QStringList _roles;
+  
+  QVector<int> _ports;
+  QVector<int> _portRoles;
+  QVector<int> _values;
 };
 
 #endif
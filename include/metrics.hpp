@@ -0,0 +1,109 @@
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <QByteArray>
+#include <QAtomicInteger>
+
+// Process-wide counters and histograms, exported in the Prometheus text
+// format by MetricsServer. Recording is a relaxed atomic add and never
+// takes a lock, so instruments can sit on the tick and packet paths.
+class Metrics
+{
+public:
+  class Counter
+  {
+  public:
+    // name and labels are exported as-is, e.g. "ks2_x_total" and
+    // "cache=\"board\""; every string must outlive the process
+    Counter(const char *const name, const char *const labels, const char *const help);
+  
+    void add(const quint64 n = 1)
+    {
+      _value.fetchAndAddRelaxed(n);
+    }
+  
+    quint64 value() const;
+  
+  private:
+    friend class Metrics;
+  
+    const char *_name;
+    const char *_labels;
+    const char *_help;
+    QAtomicInteger<quint64> _value;
+    Counter *_next;
+  };
+  
+  // HDR-style histogram: every power of two is split into SubBuckets
+  // linear buckets, so any value from 0 to 2^64 is kept to within 25%
+  class Histogram
+  {
+  public:
+    enum
+    {
+      SubBucketBits = 2,
+      SubBuckets = 1 << SubBucketBits,
+      BucketCount = SubBuckets + (64 - SubBucketBits) * SubBuckets
+    };
+  
+    // Values are recorded as integers and exported multiplied by unit,
+    // e.g. 1e-9 to record nanoseconds and export seconds
+    Histogram(const char *const name, const char *const help, const double unit);
+  
+    void record(const quint64 value)
+    {
+      _buckets[bucket(value)].fetchAndAddRelaxed(1);
+      _count.fetchAndAddRelaxed(1);
+      _sum.fetchAndAddRelaxed(value);
+    }
+  
+    quint64 count() const;
+  
+    static int bucket(const quint64 value);
+    // Largest value that falls into bucket
+    static quint64 upperBound(const int bucket);
+  
+  private:
+    friend class Metrics;
+  
+    const char *_name;
+    const char *_help;
+    double _unit;
+    QAtomicInteger<quint64> _buckets[BucketCount];
+    QAtomicInteger<quint64> _count;
+    QAtomicInteger<quint64> _sum;
+    Histogram *_next;
+  };
+  
+  static Counter kmodPackets;
+  static Histogram kmodResponseLatency;
+  
+  static Counter ticks;
+  static Counter tickOverruns;
+  static Histogram tickDuration;
+  
+  static Counter consoleStdoutBytes;
+  static Counter consoleStderrBytes;
+  
+  static Histogram uploadSize;
+  static Histogram uploadDuration;
+  static Histogram compileDuration;
+  
+  static Counter boardCacheHits;
+  static Counter boardCacheMisses;
+  static Counter compiledBoardHits;
+  static Counter compiledBoardMisses;
+  static Counter thumbnailCacheHits;
+  static Counter thumbnailCacheMisses;
+  
+  // Every instrument in the Prometheus text exposition format
+  static QByteArray exposition();
+  
+private:
+  static Counter *_counters;
+  static Counter **_counterTail;
+  static Histogram *_histograms;
+  static Histogram **_histogramTail;
+};
+
+#endif
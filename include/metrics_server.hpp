@@ -0,0 +1,30 @@
+#ifndef _METRICS_SERVER_HPP_
+#define _METRICS_SERVER_HPP_
+
+#include <QObject>
+
+class QLocalServer;
+
+// Serves Metrics::exposition() over a local (Unix domain) socket. Every
+// connection gets a plain HTTP/1.0 response and is closed, so
+//   curl --unix-socket /tmp/ks2-<pid>.metrics http://localhost/metrics
+// works as a scrape.
+class MetricsServer : public QObject
+{
+Q_OBJECT
+public:
+	MetricsServer(QObject *parent = 0);
+	~MetricsServer();
+	
+	// A bare name is created in the platform's temporary directory
+	bool listen(const QString &name);
+	QString fullServerName() const;
+	
+private slots:
+	void newConnection();
+	
+private:
+	QLocalServer *m_server;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _RANGEFINDER_HPP_
+#define _RANGEFINDER_HPP_
+
+#include <QVector>
+#include <QPointF>
+
+class Walls;
+
+// Scanning rangefinder: beams spread evenly over a field of view centered
+// on the robot's heading, all cast in one batch
+class Rangefinder
+{
+public:
+  Rangefinder();
+  
+  void setBeams(const quint32 beams);
+  quint32 beams() const;
+  
+  // Degrees; 360 gives a full turn without a duplicated beam at the back
+  void setFieldOfView(const double fieldOfView);
+  double fieldOfView() const;
+  
+  void setRange(const double range);
+  double range() const;
+  
+  // Heading in degrees. Beams read range() when nothing is hit.
+  void scan(const Walls *const walls, const QPointF &origin, const double heading);
+  const QVector<double> &readings() const;
+  
+private:
+  void updateBeams();
+  
+  quint32 _beams;
+  double _fieldOfView;
+  double _range;
+  
+  // Beam directions relative to the heading, rotated into dx/dy per scan
+  QVector<double> _cos;
+  QVector<double> _sin;
+  QVector<double> _dx;
+  QVector<double> _dy;
+  QVector<double> _readings;
+};
+
+#endif
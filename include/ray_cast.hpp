@@ -0,0 +1,25 @@
+#ifndef _RAY_CAST_HPP_
+#define _RAY_CAST_HPP_
+
+#include <QtGlobal>
+
+// Segments in structure-of-arrays form: segment i runs from (x[i], y[i])
+// to (x[i] + ex[i], y[i] + ey[i])
+struct RayCastSegments
+{
+  const double *x;
+  const double *y;
+  const double *ex;
+  const double *ey;
+  quint32 count;
+};
+
+// Casts rays from a shared origin along the unit directions (dx[i], dy[i])
+// and writes the distance to the nearest segment, or maxRange, to
+// ranges[i]. Uses SSE2 when the compiler targets it, testing two rays per
+// instruction, and a scalar loop otherwise.
+void castRays(const RayCastSegments &segments, const double ox, const double oy,
+  const double *const dx, const double *const dy, const quint32 rays,
+  const double maxRange, double *const ranges);
+
+#endif
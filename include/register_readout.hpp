@@ -0,0 +1,17 @@
+#ifndef _REGISTER_READOUT_HPP_
+#define _REGISTER_READOUT_HPP_
+
+#include "kovan_protocol_p.hpp"
+
+// The part of the register file the GUI displays, copied out in one pass
+// so the kmod lock is held as briefly as possible
+struct RegisterReadout
+{
+  int analogs[8];
+  // 1 while a digital input reads low (pressed)
+  int digitals[8];
+  
+  void read(const Kovan::State &state);
+};
+
+#endif
@@ -1,22 +1,46 @@
 #ifndef _ROBOT_HPP_
 #define _ROBOT_HPP_
 
-#include <QTime>
 #include <QLineF>
+#include <QMutex>
+#include <QVector>
+
+#include "rangefinder.hpp"
 
 class QGraphicsItem;
 class QGraphicsRectItem;
 class QGraphicsEllipseItem;
 class QGraphicsLineItem;
+class Walls;
 
 class Robot
 {
 public:
+	// Everything update() integrates, for snapshots
+	struct Kinematics
+	{
+		double x;
+		double y;
+		double rotation;
+		double leftSpeed;
+		double rightSpeed;
+		double leftTravelDistance;
+		double rightTravelDistance;
+	};
+	
 	Robot();
 	~Robot();
 
 	void reset();
 	
+	// Geometry the robot collides with and its sensors see; must be
+	// replaced under the same lock that guards update()
+	void setWalls(const Walls *walls);
+	const Walls *walls() const;
+	
+	void setCollisionRadius(const double &collisionRadius);
+	const double &collisionRadius() const;
+	
 	void setWheelDiameter(const double &wheelDiameter);
 	const double &wheelDiameter() const;
 	
@@ -24,10 +48,19 @@ public:
 	const double &wheelRadii() const;
 	
 	void setLeftSpeed(const double &leftSpeed);
-	const double &leftSpeed() const;
+	double leftSpeed() const;
 	
 	void setRightSpeed(const double &rightSpeed);
-	const double &rightSpeed() const;
+	double rightSpeed() const;
+	
+	void setPosition(const QPointF &position);
+	QPointF position() const;
+	
+	void setRotation(const double &rotation);
+	double rotation() const;
+	
+	Kinematics kinematics() const;
+	void setKinematics(const Kinematics &kinematics);
 	
 	void setLeftTravelDistance(double leftTravelDistance);
 	double leftTravelDistance() const;
@@ -42,22 +75,44 @@ public:
 	double frontRange() const;
 	double rightRange() const;
 	
+	// Optional scanning rangefinder; disabled until it is given beams
+	Rangefinder *rangefinder();
+	const QVector<double> &scan() const;
+	
 	double leftReflectance() const;
 	double rightReflectance() const;
+	
+	// True while a wall touches the left or right half of the robot's front
+	bool leftBump() const;
+	bool rightBump() const;
 
-	void update();
-  void restartTime();
+	// Integrates the drive exactly over steps intervals of sec seconds each,
+	// taking the pose lock once. The result only depends on sec and steps,
+	// so a batched fast-forward reproduces a real-time run. Safe to call
+	// from the simulation thread; sensor reads must hold the same lock as
+	// the caller.
+	void update(const double &sec, const quint32 &steps = 1);
+	
+	// Moves the graphics items to a published pose and redraws the range
+	// beams from there; GUI thread only
+	void syncGraphics(const QPointF &position, const double &rotation);
 
 	QList<QGraphicsItem *> robot() const;
 	
+	// Marks every sensor stale; readings are recomputed on their next read
+	void invalidateSensors();
+	
 private:
-	void updateRangeLines();
+	void advance(const double &sec);
+	void moveBy(QPointF &pos, QPointF delta) const;
 	
-	void updateReflectances();
-
-	double reflectanceReading(double sensorX, double sensorY);
-
-	QLineF intersectDistance(QGraphicsLineItem *item, const double &baseAngle) const;
+	// Casts the three range sensors from a pose, returning their directions
+	void castRanges(const QPointF &origin, const double &rotation, double *const dx, double *const dy,
+		double *const ranges) const;
+	void updateRanges() const;
+	void updateBumps() const;
+	double reflectanceAt(const double &baseAngle) const;
+	double reflectanceReading(double sensorX, double sensorY) const;
 	
 	double m_wheelDiameter;
 	double m_wheelRadii;
@@ -65,13 +120,24 @@ private:
 	double m_rightSpeed;
 	double m_rangeLength;
 
-	double m_leftReflectance;
-	double m_rightReflectance;
+	mutable double m_ranges[3];
+	mutable double m_leftReflectance;
+	mutable double m_rightReflectance;
+	mutable bool m_leftBump;
+	mutable bool m_rightBump;
+	mutable Rangefinder m_rangefinder;
+	mutable quint8 m_stale;
 	
 	double m_leftTravelDistance;
 	double m_rightTravelDistance;
 	
-	QTime m_time;
+	double m_x;
+	double m_y;
+	double m_rotation;
+	mutable QMutex m_mutex;
+	
+	const Walls *m_walls;
+	double m_collisionRadius;
 	
 	QGraphicsRectItem *m_robot;
 	QGraphicsEllipseItem *m_leftWheel;
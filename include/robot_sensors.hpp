@@ -0,0 +1,78 @@
+#ifndef _ROBOT_SENSORS_HPP_
+#define _ROBOT_SENSORS_HPP_
+
+#include <QMap>
+
+#include "kovan_kmod_sim.hpp"
+
+class Robot;
+class Light;
+
+// Evaluates the robot's sensors on demand when the controller reads the
+// register file. Each sensor is computed at most once per simulation step.
+class RobotSensors : public Kovan::SensorProvider
+{
+public:
+  enum AnalogRole
+  {
+    LeftRange = 0,
+    FrontRange,
+    RightRange,
+    LeftLight,
+    RightLight,
+    LeftReflectance,
+    RightReflectance,
+    AnalogRoleCount
+  };
+  
+  enum DigitalRole
+  {
+    LeftTouch = 0,
+    RightTouch,
+    DigitalRoleCount
+  };
+  
+  RobotSensors(Robot *const robot, Light *const light);
+  
+  // Compiles a port -> role mapping into the register routing tables
+  void setAnalogMapping(const QMap<int, int> &mapping);
+  void setDigitalMapping(const QMap<int, int> &mapping);
+  
+  // Starts a new simulation step, discarding every memoized reading
+  void invalidate();
+  
+  unsigned short analog(const AnalogRole role);
+  bool digital(const DigitalRole role);
+  
+  virtual void sample(Kovan::State &state);
+  
+private:
+  struct Route
+  {
+    quint8 role;
+    quint8 reg;
+  };
+  
+  unsigned short evaluateAnalog(const AnalogRole role) const;
+  bool evaluateDigital(const DigitalRole role);
+  unsigned short light(const double &baseAngle) const;
+  
+  Robot *_robot;
+  Light *_light;
+  
+  Route _analogRoutes[8];
+  quint8 _analogRouteCount;
+  quint32 _analogRoles;
+  
+  Route _digitalRoutes[8];
+  quint8 _digitalRouteCount;
+  quint32 _digitalRoles;
+  unsigned short _digitalMask;
+  
+  unsigned short _analogs[AnalogRoleCount];
+  bool _digitals[DigitalRoleCount];
+  quint32 _analogValid;
+  quint32 _digitalValid;
+};
+
+#endif
@@ -9,8 +9,20 @@ Q_OBJECT
 public:
 	ScalingGraphicsView(QWidget *parent = 0);
 	
+	// Static scene drawn (and cached) behind the view's own scene
+	void setBoardScene(QGraphicsScene *board);
+	QGraphicsScene *boardScene() const;
+	
+private slots:
+	void boardChanged(const QList<QRectF> &region);
+	
 protected:
 	void resizeEvent(QResizeEvent *event);
+	void paintEvent(QPaintEvent *event);
+	void drawBackground(QPainter *painter, const QRectF &rect);
+	
+private:
+	QGraphicsScene *m_board;
 };
 
 #endif
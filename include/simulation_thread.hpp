@@ -0,0 +1,92 @@
+#ifndef _SIMULATION_THREAD_HPP_
+#define _SIMULATION_THREAD_HPP_
+
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+
+class Robot;
+class RobotSensors;
+class Telemetry;
+
+namespace Kovan
+{
+	class KmodSim;
+}
+
+// Steps the motors, the robot and the sensor cache at a fixed rate on its
+// own thread. The GUI only samples the snapshot published after each tick.
+class SimulationThread : public QThread
+{
+Q_OBJECT
+public:
+	struct Snapshot
+	{
+		quint64 tick;
+		double time;
+		double x;
+		double y;
+		double rotation;
+		double motorOutputs[4];
+	};
+	
+	struct Stats
+	{
+		quint64 ticks;
+		// Ticks that were due while a previous tick was still running
+		quint64 overruns;
+		qint64 lastTickNs;
+		qint64 maxTickNs;
+		qint64 totalTickNs;
+	};
+	
+	SimulationThread(Kovan::KmodSim *kmod, Robot *robot, RobotSensors *sensors, QObject *parent = 0);
+	~SimulationThread();
+	
+	void setRate(const unsigned int hz);
+	unsigned int rate() const;
+	
+	// Register channels driving the left and right wheel, or -1
+	void setWheelChannels(const int left, const int right);
+	
+	// Simulation clock. The caller must hold the kmod mutex.
+	void clock(quint64 &tick, double &time) const;
+	void setClock(const quint64 tick, const double time);
+	
+	// Appends a sample to telemetry after every tick until set back to 0
+	void setTelemetry(Telemetry *telemetry);
+	
+	Snapshot snapshot() const;
+	Stats stats() const;
+	void resetStats();
+	
+	void stop();
+	
+protected:
+	void run();
+	
+private:
+	void tick(const double dt);
+	// Accounts for the steps taken in one wake-up, which are more than one
+	// when catching up after an overrun
+	void publish(const quint64 steps, const qint64 stepsNs, const qint64 longestNs, const quint64 overruns);
+	void record();
+	
+	Kovan::KmodSim *m_kmod;
+	Robot *m_robot;
+	RobotSensors *m_sensors;
+	Telemetry *m_telemetry;
+	
+	QAtomicInt m_rate;
+	QAtomicInt m_stop;
+	int m_wheels[2];
+	
+	quint64 m_tick;
+	double m_time;
+	
+	mutable QMutex m_publishMutex;
+	Snapshot m_snapshot;
+	Stats m_stats;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef _TELEMETRY_HPP_
+#define _TELEMETRY_HPP_
+
+#include <QThread>
+#include <QFile>
+#include <QVector>
+#include <QByteArray>
+#include <QSemaphore>
+#include <QAtomicInt>
+
+// Per-tick time series of the robot's pose, motor outputs and sensors,
+// written to a compact columnar file by a background thread.
+//
+// The tick thread only copies each sample into a preallocated ring of
+// chunks; the writer quantizes every finished chunk to integers and stores
+// each column as zigzag varints of the difference to the previous value.
+// Every chunk starts from zero, so chunks decode independently. If the
+// writer falls behind by the whole ring, samples are dropped rather than
+// stalling the simulation or growing memory.
+class Telemetry : public QThread
+{
+public:
+  struct Sample
+  {
+    quint64 tick;
+    double time;
+    double x;
+    double y;
+    double rotation;
+    double motors[4];
+    // Indexed by RobotSensors::AnalogRole
+    quint16 analogs[7];
+    // Bit i is RobotSensors::DigitalRole i
+    quint8 digitals;
+  };
+  
+  enum Column
+  {
+    TickColumn = 0,
+    TimeColumn,
+    XColumn,
+    YColumn,
+    RotationColumn,
+    MotorColumn,
+    AnalogColumn = MotorColumn + 4,
+    DigitalColumn = AnalogColumn + 7,
+    ColumnCount
+  };
+  
+  // The file is a FileHeader, a ColumnHeader per column, then chunks: a
+  // ChunkHeader, the byte size of every column as quint32, and the columns.
+  // A value decodes to the running sum of its deltas times the scale.
+  struct FileHeader
+  {
+    quint32 magic;
+    quint32 version;
+    quint32 columns;
+    quint32 chunkSamples;
+  };
+  
+  struct ColumnHeader
+  {
+    char name[24];
+    double scale;
+  };
+  
+  struct ChunkHeader
+  {
+    quint32 magic;
+    quint32 samples;
+  };
+  
+  Telemetry(QObject *const parent = 0);
+  ~Telemetry();
+  
+  // Truncates path and starts the writer thread
+  bool open(const QString &path);
+  // Writes out every queued sample and stops the writer. No append() may run
+  // concurrently.
+  void close();
+  bool isOpen() const;
+  
+  // Called from a single thread, typically once per simulation tick. Never
+  // blocks or allocates.
+  void append(const Sample &sample);
+  
+  // Samples lost because the writer fell behind
+  quint64 dropped() const;
+  
+  static bool load(const QString &path, QVector<Sample> &samples);
+  
+protected:
+  void run();
+  
+private:
+  enum
+  {
+    ChunkSamples = 1024,
+    Chunks = 16,
+    // Set on the size of the last chunk of a recording
+    FinalChunk = 0x80000000
+  };
+  
+  void acquireChunk();
+  void publishChunk(const quint32 size);
+  bool writeChunk(const Sample *const samples, const quint32 count);
+  
+  QFile _file;
+  
+  QVector<Sample> _ring;
+  quint32 _sizes[Chunks];
+  // Chunks the producer may fill and chunks waiting for the writer
+  QSemaphore _free;
+  QSemaphore _full;
+  
+  // Producer side: the chunk being filled (-1 while the ring is full)
+  int _current;
+  int _next;
+  quint32 _fill;
+  QAtomicInt _dropped;
+  
+  // Writer side
+  QByteArray _columns[ColumnCount];
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _TRACE_HPP_
+#define _TRACE_HPP_
+
+#include <QString>
+#include <QAtomicInt>
+
+// Scoped timing spans for finding where a stutter comes from. Each thread
+// appends finished spans to its own fixed-size ring, so recording takes no
+// lock and no allocation; the oldest spans are overwritten. While tracing
+// is disabled a span costs one relaxed load.
+//
+//   void Foo::bar()
+//   {
+//     TRACE_SPAN("foo.bar");
+//     ...
+//   }
+//
+// Names must be string literals; only the pointer is stored.
+class Trace
+{
+public:
+  class Span
+  {
+  public:
+    Span(const char *const name)
+      : _name(name)
+      , _start(Trace::isEnabled() ? Trace::now() : -1)
+    {
+    }
+  
+    ~Span()
+    {
+      if(_start >= 0) Trace::record(_name, _start);
+    }
+  
+  private:
+    const char *_name;
+    qint64 _start;
+  };
+  
+  static void setEnabled(const bool enabled);
+  static bool isEnabled()
+  {
+    return _enabled.load();
+  }
+  
+  // Drops every recorded span
+  static void clear();
+  
+  // Writes every recorded span as Chrome trace-event JSON, viewable in
+  // chrome://tracing or Perfetto
+  static bool dump(const QString &path);
+  
+  // Nanoseconds on a process-wide monotonic clock
+  static qint64 now();
+  
+private:
+  static void record(const char *const name, const qint64 start);
+  
+  static QAtomicInt _enabled;
+};
+
+#define TRACE_SPAN_CONCAT(a, b) a ## b
+#define TRACE_SPAN_NAME(line) TRACE_SPAN_CONCAT(traceSpan, line)
+#define TRACE_SPAN(name) Trace::Span TRACE_SPAN_NAME(__LINE__)(name)
+
+#endif
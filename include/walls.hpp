@@ -0,0 +1,80 @@
+#ifndef _WALLS_HPP_
+#define _WALLS_HPP_
+
+#include <QVector>
+#include <QPointF>
+
+class BoardFile;
+
+// Collision geometry for a board: its Real lines bucketed into the board's
+// uniform grid, along with the painted bounds of its Tape lines for the
+// reflectance sensors. Immutable once built, so any number of robots can
+// query it concurrently.
+class Walls
+{
+public:
+  struct Segment
+  {
+    double x1;
+    double y1;
+    double x2;
+    double y2;
+  };
+  
+  Walls(const BoardFile *const board);
+  
+  // Sweeps a circle from 'from' by 'delta'. Returns the fraction of delta
+  // that can be travelled before touching a wall (1.0 if unobstructed) and
+  // sets normal to the wall's normal, pointing towards the circle.
+  double sweep(const QPointF &from, const QPointF &delta, const double radius, QPointF *normal) const;
+  
+  // Directions from center towards every wall within radius + slop
+  QVector<QPointF> contacts(const QPointF &center, const double radius, const double slop) const;
+  
+  // Casts rays from origin along the unit directions (dx[i], dy[i]) in one
+  // batch; every ray is tested against the walls within maxRange at once
+  void cast(const QPointF &origin, const double *const dx, const double *const dy,
+    const quint32 rays, const double maxRange, double *const ranges) const;
+  
+  // Number of Tape lines whose painted bounds overlap the unit square with
+  // its top left corner at (x, y)
+  quint32 tapesAt(const double x, const double y) const;
+  
+  quint32 segmentCount() const;
+  
+private:
+  struct Box
+  {
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+  };
+  
+
+  void cellRange(const double x0, const double y0, const double x1, const double y1,
+    int &c0, int &r0, int &c1, int &r1) const;
+  
+  QVector<Segment> _segments;
+  
+  // The same segments as start points and directions for the ray kernel
+  QVector<double> _sx;
+  QVector<double> _sy;
+  QVector<double> _sex;
+  QVector<double> _sey;
+  
+  double _x;
+  double _y;
+  double _cellSize;
+  int _columns;
+  int _rows;
+  QVector<quint32> _start;
+  QVector<quint32> _items;
+  
+  // Tape bounds bucketed into the same grid, by the cells they overlap
+  QVector<Box> _tapes;
+  QVector<quint32> _tapeStart;
+  QVector<quint32> _tapeItems;
+};
+
+#endif
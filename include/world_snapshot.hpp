@@ -0,0 +1,35 @@
+#ifndef _WORLD_SNAPSHOT_HPP_
+#define _WORLD_SNAPSHOT_HPP_
+
+#include <QString>
+
+#include "kovan_protocol_p.hpp"
+#include "kovan_motor_sim.hpp"
+#include "robot.hpp"
+
+// Complete, fixed-size copy of the simulated world. Restoring one is a
+// handful of memcpys, so it can be used to reset runs or fork them from
+// a checkpoint.
+struct WorldSnapshot
+{
+  WorldSnapshot();
+  
+  void setBoard(const QString &board);
+  QString board() const;
+  
+  quint64 tick;
+  double time;
+  
+  Kovan::State state;
+  Kovan::MotorSim motors[4];
+  Robot::Kinematics robot;
+  
+  double lightX;
+  double lightY;
+  quint32 lightOn;
+  
+  // UTF-8 board name, NUL terminated
+  char boardName[64];
+};
+
+#endif
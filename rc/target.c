@@ -5,6 +5,14 @@
 #include <stdlib.h>
 #include <kovan/camera.h>
 
+#ifndef _WIN32
+#include <string.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -23,6 +31,160 @@ void __set_vision_config_path() {
 	set_camera_config_base_path(path);
 }
 
+#ifndef _WIN32
+
+// Loops like while(!digital(8)); would otherwise ask the simulator for its
+// state as fast as loopback allows. Once a sensor read has returned the same
+// value __KS2_SPIN_LIMIT times in a row, every further read first sleeps in a
+// wait command until the sensor's register changes, then reads as usual.
+
+#define __KS2_PORT 4628
+#define __KS2_SPIN_LIMIT 16
+#define __KS2_WAIT_TIMEOUT 20 // milliseconds
+#define __KS2_REPLY_SLACK 100 // milliseconds
+
+// Mirrors kovan_protocol_p.hpp and kovan_regs_p.hpp in the simulator
+#define __KS2_STATE_COMMAND 1
+#define __KS2_WAIT_COMMAND 3
+#define __KS2_DIG_IN 1
+#define __KS2_AN_IN_0 2
+
+struct __ks2_command
+{
+	int type;
+	unsigned char data[16];
+};
+
+struct __ks2_packet
+{
+	unsigned short num;
+	struct __ks2_command commands[1];
+};
+
+struct __ks2_wait
+{
+	unsigned short timeout;
+	unsigned short count;
+	struct
+	{
+		unsigned short addy;
+		unsigned short val;
+	} registers[3];
+};
+
+struct __ks2_state
+{
+	unsigned short t[200];
+};
+
+// Per thread, so concurrent waits never take each other's replies
+static __thread int __ks2_socket = -1;
+static __thread int __ks2_disabled = 0;
+static __thread int __ks2_have_state = 0;
+static __thread struct __ks2_state __ks2_last;
+static __thread int __ks2_last_key = -1;
+static __thread int __ks2_last_value = 0;
+static __thread int __ks2_repeats = 0;
+
+static int __ks2_request(const struct __ks2_packet *packet, const int timeout)
+{
+	struct __ks2_state stale;
+	struct sockaddr_in addr;
+	struct pollfd fd;
+
+	if(__ks2_socket < 0) __ks2_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if(__ks2_socket < 0) return 0;
+
+	// Replies that arrived after their request timed out
+	while(recv(__ks2_socket, &stale, sizeof(stale), MSG_DONTWAIT) > 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(__KS2_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(sendto(__ks2_socket, packet, sizeof(*packet), 0, (const struct sockaddr *)&addr, sizeof(addr)) != sizeof(*packet)) return 0;
+
+	fd.fd = __ks2_socket;
+	fd.events = POLLIN;
+	fd.revents = 0;
+	if(poll(&fd, 1, timeout) <= 0) return 0;
+	return recv(__ks2_socket, &__ks2_last, sizeof(__ks2_last), 0) == sizeof(__ks2_last);
+}
+
+static void __ks2_wait_for_change(const unsigned short reg)
+{
+	struct __ks2_packet packet;
+	struct __ks2_wait wait;
+
+	if(__ks2_disabled || reg >= sizeof(__ks2_last.t) / sizeof(__ks2_last.t[0])) return;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.num = 1;
+	if(!__ks2_have_state) {
+		packet.commands[0].type = __KS2_STATE_COMMAND;
+		__ks2_have_state = __ks2_request(&packet, __KS2_REPLY_SLACK);
+		if(!__ks2_have_state) {
+			__ks2_disabled = 1;
+			return;
+		}
+	}
+
+	memset(&wait, 0, sizeof(wait));
+	wait.timeout = __KS2_WAIT_TIMEOUT;
+	wait.count = 1;
+	wait.registers[0].addy = reg;
+	wait.registers[0].val = __ks2_last.t[reg];
+	packet.commands[0].type = __KS2_WAIT_COMMAND;
+	memcpy(packet.commands[0].data, &wait, sizeof(wait));
+	__ks2_have_state = __ks2_request(&packet, __KS2_WAIT_TIMEOUT + __KS2_REPLY_SLACK);
+
+	// A simulator without wait commands never answers; spin as before
+	if(!__ks2_have_state) __ks2_disabled = 1;
+}
+
+// Counts how often key has read value in a row
+static void __ks2_seen(const int key, const int value)
+{
+	if(key == __ks2_last_key && value == __ks2_last_value) {
+		++__ks2_repeats;
+		return;
+	}
+	__ks2_last_key = key;
+	__ks2_last_value = value;
+	__ks2_repeats = 0;
+}
+
+static int __ks2_read(const char *const name, int (**real)(int), const int key, const unsigned short reg, const int port)
+{
+	int value;
+	if(!*real) *real = (int (*)(int))dlsym(RTLD_NEXT, name);
+	if(!*real) return 0;
+	if(key == __ks2_last_key && __ks2_repeats >= __KS2_SPIN_LIMIT) __ks2_wait_for_change(reg);
+	value = (*real)(port);
+	__ks2_seen(key, value);
+	return value;
+}
+
+int digital(int port)
+{
+	static int (*real)(int) = 0;
+	return __ks2_read("digital", &real, port, __KS2_DIG_IN, port);
+}
+
+int analog(int port)
+{
+	static int (*real)(int) = 0;
+	return __ks2_read("analog", &real, 0x100 | port, __KS2_AN_IN_0 + port, port);
+}
+
+int analog10(int port)
+{
+	static int (*real)(int) = 0;
+	return __ks2_read("analog10", &real, 0x200 | port, __KS2_AN_IN_0 + port, port);
+}
+
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,31 +1,176 @@
 #include "board_file.hpp"
+#include "metrics.hpp"
 
 #include <QGraphicsScene>
 #include <QFile>
 #include <QFileInfo>
+#include <QSaveFile>
+#include <QDateTime>
 #include <QDebug>
 #include <QGraphicsLineItem>
+#include <QGraphicsRectItem>
+#include <QMultiHash>
+#include <QPainter>
+#include <QPair>
+#include <QtAlgorithms>
+#include <cmath>
+#include <cstring>
+
+// Rough cost of one graphics item with its private data and BSP index entry
+#define SCENE_ITEM_COST 256
+
+#define COMPILED_SUFFIX "c"
+#define COMPILED_MAGIC 0x4342534B // "KSBC" in native byte order
+#define COMPILED_VERSION 1
+
+#define GRID_MIN_CELL 5.0
+#define GRID_MAX_SIDE 256
+
+namespace
+{
+  struct CompiledHeader
+  {
+    quint32 magic;
+    quint32 version;
+    qint64 sourceModified;
+    qint64 sourceSize;
+    double bounds[4];
+    quint32 styleCount;
+    quint32 lineCount;
+    quint32 rectCount;
+    quint32 orderCount;
+    double gridX;
+    double gridY;
+    double cellSize;
+    quint32 columns;
+    quint32 rows;
+    quint32 cellItemCount;
+    quint32 reserved;
+  };
+  
+  Q_STATIC_ASSERT(sizeof(CompiledHeader) % 8 == 0);
+  Q_STATIC_ASSERT(sizeof(BoardFile::Style) == 16);
+  Q_STATIC_ASSERT(sizeof(BoardFile::Line) == 48);
+  Q_STATIC_ASSERT(sizeof(BoardFile::Rect) == 48);
+  
+  inline qint64 align8(const qint64 offset)
+  {
+    return (offset + 7) & ~qint64(7);
+  }
+  
+  // A compiled board that matches its source can still be truncated or
+  // written by a different build. Every index the loaders follow has to be
+  // in range before the mapping is used.
+  bool validRecords(const CompiledHeader &header, const uchar *const data, const qint64 lines,
+    const qint64 rects, const qint64 order, const qint64 start, const qint64 items, const quint32 rectOrder)
+  {
+    const BoardFile::Line *const lineData = reinterpret_cast<const BoardFile::Line *>(data + lines);
+    for(quint32 i = 0; i < header.lineCount; ++i) {
+      if(lineData[i].style >= header.styleCount) return false;
+    }
+    
+    const BoardFile::Rect *const rectData = reinterpret_cast<const BoardFile::Rect *>(data + rects);
+    for(quint32 i = 0; i < header.rectCount; ++i) {
+      if(rectData[i].style >= header.styleCount) return false;
+    }
+    
+    const quint32 *const orderData = reinterpret_cast<const quint32 *>(data + order);
+    for(quint32 i = 0; i < header.orderCount; ++i) {
+      const quint32 index = orderData[i] & ~rectOrder;
+      if(index >= (orderData[i] & rectOrder ? header.rectCount : header.lineCount)) return false;
+    }
+    
+    // The grid is only ever empty for a board without lines
+    const quint64 cells = static_cast<quint64>(header.columns) * header.rows;
+    if(header.lineCount && (!cells || !(header.cellSize > 0.0))) return false;
+    
+    const quint32 *const startData = reinterpret_cast<const quint32 *>(data + start);
+    if(startData[0] != 0 || startData[cells] != header.cellItemCount) return false;
+    for(quint64 i = 0; i < cells; ++i) {
+      if(startData[i] > startData[i + 1]) return false;
+    }
+    
+    const quint32 *const itemData = reinterpret_cast<const quint32 *>(data + items);
+    for(quint32 i = 0; i < header.cellItemCount; ++i) {
+      if(itemData[i] >= header.lineCount) return false;
+    }
+    return true;
+  }
+}
 
 BoardFile::BoardFile(QObject *const parent)
   : QObject(parent)
+  , _styles(0)
+  , _lines(0)
+  , _rects(0)
+  , _order(0)
+  , _styleCount(0)
+  , _lineCount(0)
+  , _rectCount(0)
+  , _orderCount(0)
+  , _mapped(0)
+  , _mappedSize(0)
   , _scene(0)
 {
+  _grid.x = 0.0;
+  _grid.y = 0.0;
+  _grid.cellSize = 0.0;
+  _grid.columns = 0;
+  _grid.rows = 0;
+  _grid.start = 0;
+  _grid.items = 0;
+}
+
+BoardFile::~BoardFile()
+{
+  // Closing the file also unmaps it
+  delete _mapped;
 }
 
 BoardFile *BoardFile::load(const QString &path)
 {
+  const QFileInfo source(path);
   BoardFile *boardFile = new BoardFile();
+  boardFile->_name = source.baseName();
+  boardFile->_path = source.absoluteFilePath();
+  
+  const QString compiled = compiledPath(boardFile->_path);
+  if(boardFile->map(compiled, source)) {
+    Metrics::compiledBoardHits.add();
+    return boardFile;
+  }
+  Metrics::compiledBoardMisses.add();
+  
   QFile file(path);
-  if(!file.open(QIODevice::ReadOnly)) return 0;
-  QGraphicsScene *scene = new QGraphicsScene(boardFile);
-  parse(file.readAll(), scene);
+  if(!file.open(QIODevice::ReadOnly)) {
+    delete boardFile;
+    return 0;
+  }
   
-  boardFile->_scene = scene;
-  boardFile->_name = QFileInfo(path).baseName();
+  boardFile->parse(file.readAll());
+  boardFile->buildGrid();
+  // Board locations may be read-only; the text parse is still usable
+  if(!boardFile->save(compiled, source)) {
+    qWarning() << "Failed to write compiled board" << compiled;
+  }
+  return boardFile;
+}
+
+QString BoardFile::compiledPath(const QString &path)
+{
+  return path + COMPILED_SUFFIX;
+}
+
+BoardFile *BoardFile::fromSource(const QString &name, const QString &contents)
+{
+  BoardFile *boardFile = new BoardFile();
+  boardFile->_name = name;
+  boardFile->parse(contents);
+  boardFile->buildGrid();
   return boardFile;
 }
 
-void BoardFile::parse(const QString &contents, QGraphicsScene *scene)
+void BoardFile::parse(const QString &contents)
 {
 #ifndef Q_OS_WIN
 	const QStringList lines = contents.split("\n", QString::SkipEmptyParts);
@@ -33,42 +178,38 @@ void BoardFile::parse(const QString &contents, QGraphicsScene *scene)
 	const QStringList lines = contents.split("\r\n", QString::SkipEmptyParts);
 #endif
 	quint32 lineNum = 0;
-	QPen pen;
-	QBrush brush;
+	Style style;
+	style.pen = QColor(Qt::black).rgba();
+	style.penWidth = 1;
+	style.brush = 0;
+	style.flags = 0;
+	_styleData.append(style);
 	qreal z = 0.0;
 	double unitMult = 1.0;
 	foreach(const QString &line, lines) {
 		++lineNum;
 		if(line.startsWith("#")) continue;
 		QStringList parts = line.split(" ", QString::SkipEmptyParts);
+		if(parts.isEmpty()) continue;
 		quint16 args = parts.size() - 1;
-		if(parts[0] == "line") {
-			if(args != 4) {
-				error(lineNum, 4, args);
-				continue;
-			}
-			QGraphicsItem *item = scene->addLine(parts[1].toDouble() * unitMult, parts[2].toDouble() * unitMult,
-				parts[3].toDouble() * unitMult, parts[4].toDouble() * unitMult, pen);
-			item->setData(0, BoardFile::Real);
-			item->setZValue(z);
-		} else if(parts[0] == "dec-line") {
-			if(args != 4) {
-				error(lineNum, 4, args);
-				continue;
-			}
-			QGraphicsItem *item = scene->addLine(parts[1].toDouble() * unitMult, parts[2].toDouble() * unitMult,
-				parts[3].toDouble() * unitMult, parts[4].toDouble() * unitMult, pen);
-			item->setData(0, BoardFile::Fake);
-			item->setZValue(z);
-		} else if(parts[0] == "tape") {
+		if(parts[0] == "line" || parts[0] == "dec-line" || parts[0] == "tape") {
 			if(args != 4) {
 				error(lineNum, 4, args);
 				continue;
 			}
-			QGraphicsItem *item = scene->addLine(parts[1].toDouble() * unitMult, parts[2].toDouble() * unitMult,
-				parts[3].toDouble() * unitMult, parts[4].toDouble() * unitMult, pen);
-			item->setData(0, BoardFile::Tape);
-			item->setZValue(z);
+			Line l;
+			l.x1 = parts[1].toDouble() * unitMult;
+			l.y1 = parts[2].toDouble() * unitMult;
+			l.x2 = parts[3].toDouble() * unitMult;
+			l.y2 = parts[4].toDouble() * unitMult;
+			if(parts[0] == "line") l.type = BoardFile::Real;
+			else if(parts[0] == "tape") l.type = BoardFile::Tape;
+			else l.type = BoardFile::Fake;
+			l.z = z;
+			l.style = _styleData.size() - 1;
+			_orderData.append(_lineData.size());
+			_lineData.append(l);
+			_bounds |= QRectF(QPointF(l.x1, l.y1), QPointF(l.x2, l.y2)).normalized();
 		} else if(parts[0] == "set-z") {
 			if(args != 1) {
 				error(lineNum, 1, args);
@@ -80,22 +221,35 @@ void BoardFile::parse(const QString &contents, QGraphicsScene *scene)
 				error(lineNum, 4, args);
 				continue;
 			}
-			QGraphicsItem *item = scene->addRect(parts[1].toDouble() * unitMult, parts[2].toDouble() * unitMult,
-				parts[3].toDouble() * unitMult, parts[4].toDouble() * unitMult, pen, brush);
-			item->setData(0, BoardFile::Fake);
-			item->setZValue(z);
+			Rect r;
+			r.x = parts[1].toDouble() * unitMult;
+			r.y = parts[2].toDouble() * unitMult;
+			r.w = parts[3].toDouble() * unitMult;
+			r.h = parts[4].toDouble() * unitMult;
+			r.z = z;
+			r.style = _styleData.size() - 1;
+			r.reserved = 0;
+			_orderData.append(RectOrder | _rectData.size());
+			_rectData.append(r);
+			_bounds |= r.rect().normalized();
 		} else if(parts[0] == "pen") {
 			if(args != 2) {
 				error(lineNum, 2, args);
 				continue;
 			}
-			pen = QPen(QBrush(QColor(parts[1])), parts[2].toUInt());
+			style.pen = QColor(parts[1]).rgba();
+			style.penWidth = parts[2].toUInt();
+			_styleData.append(style);
 		} else if(parts[0] == "brush") {
 			if(args != 1) {
 				error(lineNum, 1, args);
 				continue;
 			}
-			brush = QBrush(QColor(parts[1]));
+			const QColor brush(parts[1]);
+			style.brush = brush.rgba();
+			if(brush.isValid()) style.flags |= Style::HasBrush;
+			else style.flags &= ~Style::HasBrush;
+			_styleData.append(style);
 		} else if(parts[0] == "set-units") {
 			if(args != 1) {
 				error(lineNum, 1, args);
@@ -108,6 +262,301 @@ void BoardFile::parse(const QString &contents, QGraphicsScene *scene)
 			} else error(lineNum, parts[1]);
 		} else error(lineNum, parts[0]);
 	}
+	
+	_styles = _styleData.constData();
+	_styleCount = _styleData.size();
+	_lines = _lineData.constData();
+	_lineCount = _lineData.size();
+	_rects = _rectData.constData();
+	_rectCount = _rectData.size();
+	_order = _orderData.constData();
+	_orderCount = _orderData.size();
+}
+
+void BoardFile::buildGrid()
+{
+  _grid.x = _bounds.x();
+  _grid.y = _bounds.y();
+  _grid.columns = 0;
+  _grid.rows = 0;
+  _cellStartData.fill(0, 1);
+  _cellItemData.clear();
+  
+  if(_lineCount) {
+    // Aim for about one line per cell, but keep the grid bounded
+    const double w = qMax(_bounds.width(), GRID_MIN_CELL);
+    const double h = qMax(_bounds.height(), GRID_MIN_CELL);
+    double cellSize = qMax(GRID_MIN_CELL, std::sqrt(w * h / _lineCount));
+    cellSize = qMax(cellSize, qMax(w, h) / GRID_MAX_SIDE);
+    _grid.cellSize = cellSize;
+    _grid.columns = qMax(1, static_cast<int>(std::ceil(w / cellSize)));
+    _grid.rows = qMax(1, static_cast<int>(std::ceil(h / cellSize)));
+    
+    // Two passes over each line's cell span: count, then fill (CSR layout)
+    const quint32 cells = _grid.columns * _grid.rows;
+    _cellStartData.fill(0, cells + 1);
+    for(int pass = 0; pass < 2; ++pass) {
+      QVector<quint32> cursor;
+      if(pass) {
+        for(quint32 i = 0; i < cells; ++i) _cellStartData[i + 1] += _cellStartData[i];
+        _cellItemData.resize(_cellStartData[cells]);
+        cursor = _cellStartData;
+      }
+      for(quint32 i = 0; i < _lineCount; ++i) {
+        const Line &l = _lines[i];
+        const int c0 = qBound(0, static_cast<int>((qMin(l.x1, l.x2) - _grid.x) / cellSize), static_cast<int>(_grid.columns) - 1);
+        const int c1 = qBound(0, static_cast<int>((qMax(l.x1, l.x2) - _grid.x) / cellSize), static_cast<int>(_grid.columns) - 1);
+        const int r0 = qBound(0, static_cast<int>((qMin(l.y1, l.y2) - _grid.y) / cellSize), static_cast<int>(_grid.rows) - 1);
+        const int r1 = qBound(0, static_cast<int>((qMax(l.y1, l.y2) - _grid.y) / cellSize), static_cast<int>(_grid.rows) - 1);
+        for(int r = r0; r <= r1; ++r) {
+          for(int c = c0; c <= c1; ++c) {
+            const quint32 cell = r * _grid.columns + c;
+            if(pass) _cellItemData[cursor[cell]++] = i;
+            else ++_cellStartData[cell + 1];
+          }
+        }
+      }
+    }
+  }
+  
+  _grid.start = _cellStartData.constData();
+  _grid.items = _cellItemData.constData();
+}
+
+bool BoardFile::map(const QString &compiled, const QFileInfo &source)
+{
+  QFile *const file = new QFile(compiled);
+  if(!file->open(QIODevice::ReadOnly) || file->size() < static_cast<qint64>(sizeof(CompiledHeader))) {
+    delete file;
+    return false;
+  }
+  
+  const qint64 size = file->size();
+  const uchar *const data = file->map(0, size);
+  if(!data) {
+    delete file;
+    return false;
+  }
+  
+  const CompiledHeader *const header = reinterpret_cast<const CompiledHeader *>(data);
+  if(header->magic != COMPILED_MAGIC || header->version != COMPILED_VERSION
+    || header->sourceModified != source.lastModified().toMSecsSinceEpoch()
+    || header->sourceSize != source.size()) {
+    delete file;
+    return false;
+  }
+  
+  const quint64 cells = static_cast<quint64>(header->columns) * header->rows;
+  if(cells >= static_cast<quint64>(size)) {
+    delete file;
+    return false;
+  }
+  const qint64 styles = sizeof(CompiledHeader);
+  const qint64 lines = styles + header->styleCount * static_cast<qint64>(sizeof(Style));
+  const qint64 rects = lines + header->lineCount * static_cast<qint64>(sizeof(Line));
+  const qint64 order = rects + header->rectCount * static_cast<qint64>(sizeof(Rect));
+  const qint64 start = align8(order + header->orderCount * static_cast<qint64>(sizeof(quint32)));
+  const qint64 items = align8(start + (cells + 1) * sizeof(quint32));
+  const qint64 end = items + header->cellItemCount * static_cast<qint64>(sizeof(quint32));
+  if(end > size || !validRecords(*header, data, lines, rects, order, start, items, RectOrder)) {
+    delete file;
+    return false;
+  }
+  
+  _bounds = QRectF(header->bounds[0], header->bounds[1], header->bounds[2], header->bounds[3]);
+  _styles = reinterpret_cast<const Style *>(data + styles);
+  _styleCount = header->styleCount;
+  _lines = reinterpret_cast<const Line *>(data + lines);
+  _lineCount = header->lineCount;
+  _rects = reinterpret_cast<const Rect *>(data + rects);
+  _rectCount = header->rectCount;
+  _order = reinterpret_cast<const quint32 *>(data + order);
+  _orderCount = header->orderCount;
+  _grid.x = header->gridX;
+  _grid.y = header->gridY;
+  _grid.cellSize = header->cellSize;
+  _grid.columns = header->columns;
+  _grid.rows = header->rows;
+  _grid.start = reinterpret_cast<const quint32 *>(data + start);
+  _grid.items = reinterpret_cast<const quint32 *>(data + items);
+  
+  _mapped = file;
+  _mappedSize = size;
+  return true;
+}
+
+bool BoardFile::save(const QString &compiled, const QFileInfo &source) const
+{
+  CompiledHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = COMPILED_MAGIC;
+  header.version = COMPILED_VERSION;
+  header.sourceModified = source.lastModified().toMSecsSinceEpoch();
+  header.sourceSize = source.size();
+  header.bounds[0] = _bounds.x();
+  header.bounds[1] = _bounds.y();
+  header.bounds[2] = _bounds.width();
+  header.bounds[3] = _bounds.height();
+  header.styleCount = _styleCount;
+  header.lineCount = _lineCount;
+  header.rectCount = _rectCount;
+  header.orderCount = _orderCount;
+  header.gridX = _grid.x;
+  header.gridY = _grid.y;
+  header.cellSize = _grid.cellSize;
+  header.columns = _grid.columns;
+  header.rows = _grid.rows;
+  header.cellItemCount = _cellItemData.size();
+  
+  // Written to a temporary and renamed, so concurrent loaders never map
+  // a partially written file
+  QSaveFile file(compiled);
+  if(!file.open(QIODevice::WriteOnly)) return false;
+  
+  const char padding[8] = { 0 };
+  const qint64 orderSize = _orderCount * sizeof(quint32);
+  const qint64 startSize = _cellStartData.size() * sizeof(quint32);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(_styles), _styleCount * sizeof(Style));
+  file.write(reinterpret_cast<const char *>(_lines), _lineCount * sizeof(Line));
+  file.write(reinterpret_cast<const char *>(_rects), _rectCount * sizeof(Rect));
+  file.write(reinterpret_cast<const char *>(_order), orderSize);
+  file.write(padding, align8(orderSize) - orderSize);
+  file.write(reinterpret_cast<const char *>(_cellStartData.constData()), startSize);
+  file.write(padding, align8(startSize) - startSize);
+  file.write(reinterpret_cast<const char *>(_cellItemData.constData()), _cellItemData.size() * sizeof(quint32));
+  return file.commit();
+}
+
+void BoardFile::buildScene()
+{
+  _scene = new QGraphicsScene(this);
+  _items.resize(_orderCount);
+  for(quint32 i = 0; i < _orderCount; ++i) {
+    _items[i] = createItem(_order[i]);
+    _scene->addItem(_items[i]);
+  }
+}
+
+QGraphicsItem *BoardFile::createItem(const quint32 order) const
+{
+  if(order & RectOrder) {
+    const Rect &r = _rects[order & ~RectOrder];
+    QGraphicsRectItem *item = new QGraphicsRectItem(r.rect());
+    item->setPen(pen(r.style));
+    item->setBrush(brush(r.style));
+    item->setData(0, BoardFile::Fake);
+    item->setZValue(r.z);
+    return item;
+  }
+  
+  const Line &l = _lines[order];
+  QGraphicsLineItem *item = new QGraphicsLineItem(l.line());
+  item->setPen(pen(l.style));
+  item->setData(0, l.type);
+  item->setZValue(l.z);
+  return item;
+}
+
+QByteArray BoardFile::shapeKey(const quint32 order) const
+{
+  // Shapes are matched on their geometry (and line type); z and style are
+  // what a restyle may change
+  if(order & RectOrder) {
+    const Rect &r = _rects[order & ~RectOrder];
+    return QByteArray("r", 1) + QByteArray(reinterpret_cast<const char *>(&r.x), 4 * sizeof(double));
+  }
+  const Line &l = _lines[order];
+  return QByteArray(1, static_cast<char>('0' + l.type))
+    + QByteArray(reinterpret_cast<const char *>(&l.x1), 4 * sizeof(double));
+}
+
+template<typename T>
+static void assign(QVector<T> &data, const T *const values, const quint32 count)
+{
+  data.resize(count);
+  if(count) memcpy(data.data(), values, count * sizeof(T));
+}
+
+void BoardFile::merge(const BoardFile &other)
+{
+  if(_scene) {
+    QMultiHash<QByteArray, quint32> previous;
+    for(quint32 i = 0; i < _orderCount; ++i) previous.insert(shapeKey(_order[i]), i);
+    
+    QVector<QGraphicsItem *> items(other._orderCount);
+    for(quint32 i = 0; i < other._orderCount; ++i) {
+      const quint32 o = other._order[i];
+      QMultiHash<QByteArray, quint32>::iterator it = previous.find(other.shapeKey(o));
+      if(it == previous.end()) {
+        items[i] = other.createItem(o);
+        _scene->addItem(items[i]);
+        continue;
+      }
+      
+      QGraphicsItem *const item = _items[it.value()];
+      const quint32 was = _order[it.value()];
+      previous.erase(it);
+      items[i] = item;
+      
+      const quint32 style = (o & RectOrder) ? other._rects[o & ~RectOrder].style : other._lines[o].style;
+      const quint32 oldStyle = (was & RectOrder) ? _rects[was & ~RectOrder].style : _lines[was].style;
+      const qreal z = (o & RectOrder) ? other._rects[o & ~RectOrder].z : other._lines[o].z;
+      if(!memcmp(&other._styles[style], &_styles[oldStyle], sizeof(Style)) && item->zValue() == z) continue;
+      
+      if(o & RectOrder) {
+        QGraphicsRectItem *const rect = static_cast<QGraphicsRectItem *>(item);
+        rect->setPen(other.pen(style));
+        rect->setBrush(other.brush(style));
+      } else static_cast<QGraphicsLineItem *>(item)->setPen(other.pen(style));
+      item->setZValue(z);
+    }
+    
+    Q_FOREACH(const quint32 i, previous) {
+      _scene->removeItem(_items[i]);
+      delete _items[i];
+    }
+    
+    _items = items;
+  }
+  
+  // Copy the new records before dropping a mapping the old views may use
+  assign(_styleData, other._styles, other._styleCount);
+  assign(_lineData, other._lines, other._lineCount);
+  assign(_rectData, other._rects, other._rectCount);
+  assign(_orderData, other._order, other._orderCount);
+  const quint32 cells = other._grid.columns * other._grid.rows;
+  assign(_cellStartData, other._grid.start, cells + 1);
+  assign(_cellItemData, other._grid.items, other._grid.start[cells]);
+  
+  delete _mapped;
+  _mapped = 0;
+  _mappedSize = 0;
+  
+  _bounds = other._bounds;
+  _styles = _styleData.constData();
+  _styleCount = _styleData.size();
+  _lines = _lineData.constData();
+  _lineCount = _lineData.size();
+  _rects = _rectData.constData();
+  _rectCount = _rectData.size();
+  _order = _orderData.constData();
+  _orderCount = _orderData.size();
+  _grid = other._grid;
+  _grid.start = _cellStartData.constData();
+  _grid.items = _cellItemData.constData();
+}
+
+QPen BoardFile::pen(const quint32 style) const
+{
+  const Style &s = _styles[style];
+  return QPen(QBrush(QColor::fromRgba(s.pen)), s.penWidth);
+}
+
+QBrush BoardFile::brush(const quint32 style) const
+{
+  const Style &s = _styles[style];
+  return (s.flags & Style::HasBrush) ? QBrush(QColor::fromRgba(s.brush)) : QBrush();
 }
 
 void BoardFile::error(const quint32 &line, const QString &id)
@@ -125,6 +574,119 @@ const QString &BoardFile::name() const
   return _name;
 }
 
+const QString &BoardFile::path() const
+{
+  return _path;
+}
+
+bool BoardFile::isCompiled() const
+{
+  return _mapped;
+}
+
+const BoardFile::Style *BoardFile::styles() const
+{
+  return _styles;
+}
+
+quint32 BoardFile::styleCount() const
+{
+  return _styleCount;
+}
+
+const BoardFile::Line *BoardFile::lines() const
+{
+  return _lines;
+}
+
+quint32 BoardFile::lineCount() const
+{
+  return _lineCount;
+}
+
+const BoardFile::Rect *BoardFile::rects() const
+{
+  return _rects;
+}
+
+quint32 BoardFile::rectCount() const
+{
+  return _rectCount;
+}
+
+const BoardFile::Grid &BoardFile::grid() const
+{
+  return _grid;
+}
+
+QRectF BoardFile::bounds() const
+{
+  return _bounds;
+}
+
+static bool zLessThan(const QPair<qreal, quint32> &a, const QPair<qreal, quint32> &b)
+{
+  return a.first < b.first;
+}
+
+void BoardFile::render(QPainter *painter, const QRectF &target) const
+{
+  if(_bounds.isEmpty()) return;
+  
+  // Same stacking as the scene: by z, then in file order
+  QList<QPair<qreal, quint32> > order;
+  for(quint32 i = 0; i < _orderCount; ++i) {
+    const quint32 o = _order[i];
+    order.append(qMakePair((o & RectOrder) ? _rects[o & ~RectOrder].z : _lines[o].z, o));
+  }
+  qStableSort(order.begin(), order.end(), zLessThan);
+  
+  const qreal scale = qMin(target.width() / _bounds.width(), target.height() / _bounds.height());
+  painter->save();
+  painter->translate(target.center());
+  painter->scale(scale, scale);
+  painter->translate(-_bounds.center());
+  for(int i = 0; i < order.size(); ++i) {
+    const quint32 o = order[i].second;
+    if(o & RectOrder) {
+      const Rect &r = _rects[o & ~RectOrder];
+      painter->setPen(pen(r.style));
+      painter->setBrush(brush(r.style));
+      painter->drawRect(r.rect());
+    } else {
+      const Line &l = _lines[o];
+      painter->setPen(pen(l.style));
+      painter->drawLine(l.line());
+    }
+  }
+  painter->restore();
+}
+
+QImage BoardFile::thumbnail(const QSize &size) const
+{
+  QImage image(size, QImage::Format_ARGB32_Premultiplied);
+  image.fill(Qt::white);
+  QPainter p(&image);
+  p.setRenderHint(QPainter::Antialiasing);
+  render(&p, QRectF(QPointF(0.0, 0.0), size));
+  return image;
+}
+
+quint64 BoardFile::memoryUse() const
+{
+  // Mapped pages are file backed, but count them since they stay resident
+  quint64 ret = sizeof(*this) + _mappedSize
+    + _styleData.capacity() * sizeof(Style)
+    + _lineData.capacity() * sizeof(Line)
+    + _rectData.capacity() * sizeof(Rect)
+    + _orderData.capacity() * sizeof(quint32)
+    + _cellStartData.capacity() * sizeof(quint32)
+    + _cellItemData.capacity() * sizeof(quint32)
+    + _items.capacity() * sizeof(QGraphicsItem *);
+  if(_scene) ret += sizeof(QGraphicsScene) + _orderCount * SCENE_ITEM_COST;
+  return ret;
+}
+
 const QGraphicsScene *BoardFile::scene() const
 {
   return _scene;
@@ -132,5 +694,6 @@ const QGraphicsScene *BoardFile::scene() const
 
 QGraphicsScene *BoardFile::scene()
 {
+  if(!_scene) buildScene();
   return _scene;
 }
\ No newline at end of file
@@ -1,40 +1,217 @@
 #include "board_file_manager.hpp"
 #include <QFileInfo>
 #include <QDir>
+#include <QRunnable>
+#include <QMetaObject>
+#include <QFile>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <QDebug>
 #include "board_file.hpp"
+#include "metrics.hpp"
+
+#define DEFAULT_MEMORY_BUDGET (8 * 1024 * 1024)
+// Editors often write a file in several steps; wait for them to settle
+#define RELOAD_DELAY 250
+#define THUMBNAIL_SIZE 64
+
+class IndexJob : public QRunnable
+{
+public:
+  IndexJob(BoardFileManager *const manager, const QString &path, const QDateTime &modified,
+      const QString &thumbnailPath)
+    : _manager(manager)
+    , _path(path)
+    , _modified(modified)
+    , _thumbnailPath(thumbnailPath)
+  {
+  }
+  
+  void run()
+  {
+    QRectF bounds;
+    QImage thumbnail;
+    
+    // Hashing the source is far cheaper than parsing and rendering it
+    QString cached;
+    QFile file(_path);
+    if(!_thumbnailPath.isEmpty() && file.open(QIODevice::ReadOnly)) {
+      QCryptographicHash hash(QCryptographicHash::Sha1);
+      hash.addData(_path.toUtf8());
+      hash.addData(&file);
+      cached = QDir(_thumbnailPath).filePath(QString::fromLatin1(hash.result().toHex()) + ".png");
+      readCached(cached, bounds, thumbnail);
+      if(thumbnail.isNull()) Metrics::thumbnailCacheMisses.add();
+      else Metrics::thumbnailCacheHits.add();
+    }
+    
+    if(thumbnail.isNull()) {
+      BoardFile *const board = BoardFile::load(_path);
+      if(board) {
+        bounds = board->bounds();
+        thumbnail = board->thumbnail(QSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE));
+        delete board;
+        if(!cached.isEmpty()) writeCached(cached, bounds, thumbnail);
+      }
+    }
+    
+    QMetaObject::invokeMethod(_manager, "indexed", Qt::QueuedConnection,
+      Q_ARG(QString, _path), Q_ARG(QDateTime, _modified),
+      Q_ARG(QRectF, bounds), Q_ARG(QImage, thumbnail));
+  }
+  
+private:
+  // Bounds travel with the thumbnail as a PNG text chunk
+  static void readCached(const QString &path, QRectF &bounds, QImage &thumbnail)
+  {
+    QImage image(path);
+    if(image.isNull()) return;
+    const QStringList parts = image.text("bounds").split(" ", QString::SkipEmptyParts);
+    if(parts.size() != 4) return;
+    bounds = QRectF(parts[0].toDouble(), parts[1].toDouble(), parts[2].toDouble(), parts[3].toDouble());
+    thumbnail = image;
+  }
+  
+  static void writeCached(const QString &path, const QRectF &bounds, QImage thumbnail)
+  {
+    thumbnail.setText("bounds", QString("%1 %2 %3 %4").arg(bounds.x()).arg(bounds.y())
+      .arg(bounds.width()).arg(bounds.height()));
+    QDir().mkpath(QFileInfo(path).path());
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly) || !thumbnail.save(&file, "PNG") || !file.commit()) {
+      qWarning() << "Failed to write board thumbnail" << path;
+    }
+  }
+  
+  BoardFileManager *_manager;
+  QString _path;
+  QDateTime _modified;
+  QString _thumbnailPath;
+};
+
+class ParseJob : public QRunnable
+{
+public:
+  ParseJob(BoardFileManager *const manager, const char *const slot,
+      const QString &path, const QDateTime &modified)
+    : _manager(manager)
+    , _slot(slot)
+    , _path(path)
+    , _modified(modified)
+  {
+  }
+  
+  void run()
+  {
+    BoardFile *const board = BoardFile::load(_path);
+    // Hand the board over to the manager's thread before it crosses threads
+    if(board) board->moveToThread(_manager->thread());
+    QMetaObject::invokeMethod(_manager, _slot, Qt::QueuedConnection,
+      Q_ARG(QString, _path), Q_ARG(QDateTime, _modified), Q_ARG(BoardFile *, board));
+  }
+  
+private:
+  BoardFileManager *_manager;
+  const char *_slot;
+  QString _path;
+  QDateTime _modified;
+};
 
 BoardFileManager::BoardFileManager(QObject *const parent)
   : QObject(parent)
+  , _budget(DEFAULT_MEMORY_BUDGET)
+  , _clock(0)
 {
+  qRegisterMetaType<BoardFile *>("BoardFile *");
+  
+  _reloadTimer.setSingleShot(true);
+  _reloadTimer.setInterval(RELOAD_DELAY);
+  connect(&_reloadTimer, SIGNAL(timeout()), SLOT(reload()));
+  connect(&_watcher, SIGNAL(directoryChanged(QString)), &_reloadTimer, SLOT(start()));
+  connect(&_watcher, SIGNAL(fileChanged(QString)), &_reloadTimer, SLOT(start()));
 }
 
 BoardFileManager::~BoardFileManager()
 {
-  qDeleteAll(_boards);
+  _pool.waitForDone();
+  qDeleteAll(_cache.keys());
 }
 
-void BoardFileManager::addBoardFile(BoardFile *const file)
+const QList<BoardFileManager::Entry> &BoardFileManager::entries() const
 {
-  file->setParent(this);
-  _boards.push_back(file);
+  return _entries;
 }
 
-bool BoardFileManager::removeBoardFile(BoardFile *const file)
+const BoardFileManager::Entry *BoardFileManager::lookupEntry(const QString &name) const
 {
-  return _boards.removeAll(file);;
+  Q_FOREACH(const Entry &entry, _entries) {
+    if(entry.name == name) return &entry;
+  }
+  return 0;
 }
 
-const QList<BoardFile *> &BoardFileManager::boardFiles() const
+BoardFile *BoardFileManager::lookupBoardFile(const QString &name) const
 {
-  return _boards;
+  const Entry *const entry = lookupEntry(name);
+  if(!entry) return 0;
+  return _boards.value(entry->path, 0);
 }
 
-BoardFile *BoardFileManager::lookupBoardFile(const QString &name)
+bool BoardFileManager::requestBoardFile(const QString &name)
 {
-  Q_FOREACH(BoardFile *const board, _boards) {
-    if(board->name() == name) return board;
+  const Entry *const entry = lookupEntry(name);
+  if(!entry) return false;
+  
+  // A board being re-parsed for a hot reload is still current
+  BoardFile *const board = _boards.value(entry->path, 0);
+  if(board && (_cache[board].modified == entry->modified || _pending.contains(entry->path))) {
+    Metrics::boardCacheHits.add();
+    _cache[board].lastUsed = ++_clock;
+    emit boardLoaded(board);
+    return true;
   }
-  return 0;
+  
+  Metrics::boardCacheMisses.add();
+  if(_pending.contains(entry->path)) return true;
+  _pending.insert(entry->path);
+  _pool.start(new ParseJob(this, "parsed", entry->path, entry->modified));
+  return true;
+}
+
+void BoardFileManager::retain(BoardFile *const board)
+{
+  if(!_cache.contains(board)) return;
+  CacheEntry &cached = _cache[board];
+  ++cached.refs;
+  cached.lastUsed = ++_clock;
+}
+
+void BoardFileManager::release(BoardFile *const board)
+{
+  if(!_cache.contains(board)) return;
+  CacheEntry &cached = _cache[board];
+  if(cached.refs > 0) --cached.refs;
+  if(!cached.refs && _boards.value(board->path(), 0) != board) destroy(board);
+  trim();
+}
+
+void BoardFileManager::setMemoryBudget(const quint64 bytes)
+{
+  _budget = bytes;
+  trim();
+}
+
+quint64 BoardFileManager::memoryBudget() const
+{
+  return _budget;
+}
+
+quint64 BoardFileManager::memoryUse() const
+{
+  quint64 ret = 0;
+  QHash<BoardFile *, CacheEntry>::const_iterator it = _cache.constBegin();
+  for(; it != _cache.constEnd(); ++it) ret += it.key()->memoryUse();
+  return ret;
 }
 
 void BoardFileManager::addLocation(const QString &path)
@@ -42,22 +219,174 @@ void BoardFileManager::addLocation(const QString &path)
   _locations.push_back(path);
 }
 
-quint32 BoardFileManager::loadLocation(const QString &path)
+void BoardFileManager::setThumbnailPath(const QString &path)
 {
-  quint32 added = 0;
-  const QList<QFileInfo> files = QDir(path).entryInfoList(QStringList() << "*.board",
-    QDir::Files | QDir::NoDot | QDir::NoDotDot);
-  Q_FOREACH(const QFileInfo &file, files) {
-    BoardFile *const board = BoardFile::load(file.absoluteFilePath());
-    if(!board) continue;
-    addBoardFile(board);
-    ++added;
-  }
-  return added;
+  _thumbnailPath = path;
+}
+
+const QString &BoardFileManager::thumbnailPath() const
+{
+  return _thumbnailPath;
 }
 
 void BoardFileManager::reload()
 {
-  _boards.clear();
-  Q_FOREACH(const QString &loc, _locations) loadLocation(loc);
-}
\ No newline at end of file
+  QList<Entry> entries;
+  bool changed = false;
+  Q_FOREACH(const QString &loc, _locations) {
+    const QList<QFileInfo> files = QDir(loc).entryInfoList(QStringList() << "*.board",
+      QDir::Files | QDir::NoDot | QDir::NoDotDot);
+    Q_FOREACH(const QFileInfo &file, files) {
+      Entry entry;
+      entry.name = file.baseName();
+      entry.path = file.absoluteFilePath();
+      entry.modified = file.lastModified();
+      entry.indexed = false;
+      
+      const int previous = indexOf(entry.path);
+      if(previous >= 0 && _entries[previous].modified == entry.modified) {
+        entries.append(_entries[previous]);
+        continue;
+      }
+      
+      changed = true;
+      // Boards in use are merged in place so their scene stays displayed
+      BoardFile *const board = _boards.value(entry.path, 0);
+      if(board && _cache[board].refs) {
+        _pending.insert(entry.path);
+        _pool.start(new ParseJob(this, "reparsed", entry.path, entry.modified));
+      } else supersede(entry.path);
+      entries.append(entry);
+    }
+  }
+  changed = changed || entries.size() != _entries.size();
+  _entries = entries;
+  
+  Q_FOREACH(const Entry &entry, _entries) {
+    if(entry.indexed || _indexing.contains(entry.path)) continue;
+    _indexing.insert(entry.path);
+    _pool.start(new IndexJob(this, entry.path, entry.modified, _thumbnailPath));
+  }
+  
+  watch();
+  // Writing compiled boards also touches the watched directories
+  if(changed) emit catalogChanged();
+}
+
+void BoardFileManager::indexed(const QString &path, const QDateTime &modified, const QRectF &bounds, const QImage &thumbnail)
+{
+  _indexing.remove(path);
+  const int i = indexOf(path);
+  if(i < 0 || _entries[i].modified != modified) return;
+  
+  Entry &entry = _entries[i];
+  entry.bounds = bounds;
+  entry.thumbnail = thumbnail;
+  entry.indexed = true;
+  emit entryIndexed(entry.name);
+}
+
+void BoardFileManager::parsed(const QString &path, const QDateTime &modified, BoardFile *board)
+{
+  _pending.remove(path);
+  if(!board) return;
+  
+  BoardFile *const current = _boards.value(path, 0);
+  if(current && _cache[current].modified == modified) {
+    delete board;
+    return;
+  }
+  supersede(path);
+  
+  board->setParent(this);
+  CacheEntry cached;
+  cached.modified = modified;
+  cached.refs = 0;
+  cached.lastUsed = ++_clock;
+  _boards[path] = board;
+  _cache[board] = cached;
+  
+  emit boardLoaded(board);
+  trim();
+}
+
+void BoardFileManager::reparsed(const QString &path, const QDateTime &modified, BoardFile *board)
+{
+  const int i = indexOf(path);
+  if(i >= 0 && _entries[i].modified != modified) {
+    // The file changed again while this parse was running. A newer parse
+    // may not be queued, so let the next request start one.
+    _pending.remove(path);
+    delete board;
+    return;
+  }
+  
+  BoardFile *const current = _boards.value(path, 0);
+  if(!current || !board) {
+    parsed(path, modified, board);
+    return;
+  }
+  
+  _pending.remove(path);
+  current->merge(*board);
+  delete board;
+  _cache[current].modified = modified;
+  emit boardChanged(current);
+  trim();
+}
+
+int BoardFileManager::indexOf(const QString &path) const
+{
+  for(int i = 0; i < _entries.size(); ++i) {
+    if(_entries[i].path == path) return i;
+  }
+  return -1;
+}
+
+void BoardFileManager::supersede(const QString &path)
+{
+  BoardFile *const board = _boards.take(path);
+  if(board && !_cache[board].refs) destroy(board);
+}
+
+void BoardFileManager::destroy(BoardFile *const board)
+{
+  _cache.remove(board);
+  if(_boards.value(board->path(), 0) == board) _boards.remove(board->path());
+  delete board;
+}
+
+void BoardFileManager::trim()
+{
+  quint64 use = memoryUse();
+  while(use > _budget) {
+    BoardFile *victim = 0;
+    quint64 oldest = 0;
+    QHash<BoardFile *, CacheEntry>::const_iterator it = _cache.constBegin();
+    for(; it != _cache.constEnd(); ++it) {
+      if(it.value().refs) continue;
+      if(victim && it.value().lastUsed >= oldest) continue;
+      victim = it.key();
+      oldest = it.value().lastUsed;
+    }
+    if(!victim) break;
+    use -= victim->memoryUse();
+    destroy(victim);
+  }
+}
+
+void BoardFileManager::watch()
+{
+  // Editors that save by renaming drop the watch on the old file, so this
+  // runs after every rescan
+  const QStringList watched = _watcher.files() + _watcher.directories();
+  QStringList paths;
+  Q_FOREACH(const QString &loc, _locations) {
+    const QString path = QFileInfo(loc).absoluteFilePath();
+    if(QFileInfo(path).isDir() && !watched.contains(path)) paths << path;
+  }
+  Q_FOREACH(const Entry &entry, _entries) {
+    if(!watched.contains(entry.path)) paths << entry.path;
+  }
+  if(!paths.isEmpty()) _watcher.addPaths(paths);
+}
@@ -2,64 +2,27 @@
 #include "ui_board_selector_dialog.h"
 
 #include "board_file.hpp"
+#include "board_file_manager.hpp"
 
 #include <QStandardItemModel>
 #include <QStandardItem>
+#include <QPixmap>
 
-class BoardFileItem : public QStandardItem
+static QIcon entryIcon(const BoardFileManager::Entry &entry)
 {
-public:
-  BoardFileItem(BoardFile *const board);
+  if(entry.indexed && !entry.thumbnail.isNull()) return QIcon(QPixmap::fromImage(entry.thumbnail));
   
-  BoardFile *board() const;
-  
-  template<typename T>
-  static const BoardFileItem *cast(const T *const t);
-  
-  template<typename T>
-  static BoardFileItem *cast(T *const t);
-  
-private:
-  QIcon generateIcon(const quint16 w, const quint16 h) const;
-  
-  BoardFile *const _board;
-};
-
-BoardFileItem::BoardFileItem(BoardFile *const board)
-  : _board(board)
-{
-  setText(_board->name());
-  setIcon(generateIcon(64, 64));
-}
-
-BoardFile *BoardFileItem::board() const
-{
-  return _board;
-}
-
-template<typename T>
-const BoardFileItem *BoardFileItem::cast(const T *const t)
-{
-  return dynamic_cast<const BoardFileItem *>(t);
-}
-
-template<typename T>
-BoardFileItem *BoardFileItem::cast(T *const t)
-{
-  return dynamic_cast<BoardFileItem *>(t);
-}
-
-QIcon BoardFileItem::generateIcon(const quint16 w, const quint16 h) const
-{
-  QPixmap pixmap(w, h);
-  QPainter p(&pixmap);
-  _board->scene()->render(&p);
+  // Placeholder until the background index job finishes
+  QPixmap pixmap(64, 64);
+  pixmap.fill(Qt::lightGray);
   return QIcon(pixmap);
 }
 
-BoardSelectorDialog::BoardSelectorDialog(QWidget *const parent)
+BoardSelectorDialog::BoardSelectorDialog(BoardFileManager *const manager, QWidget *const parent)
   : QDialog(parent)
   , ui(new Ui::BoardSelectorDialog)
+  , _manager(manager)
+  , _preview(0)
   , _model(new QStandardItemModel(this))
 {
   ui->setupUi(this);
@@ -67,42 +30,69 @@ BoardSelectorDialog::BoardSelectorDialog(QWidget *const parent)
   ui->boards->setModel(_model);
   connect(ui->boards->selectionModel(), SIGNAL(currentChanged(QModelIndex, QModelIndex)),
     SLOT(currentChanged(QModelIndex)));
+  
+  connect(_manager, SIGNAL(catalogChanged()), SLOT(catalogChanged()));
+  connect(_manager, SIGNAL(entryIndexed(QString)), SLOT(entryIndexed(QString)));
+  connect(_manager, SIGNAL(boardLoaded(BoardFile *)), SLOT(boardLoaded(BoardFile *)));
+  
+  catalogChanged();
 }
 
 BoardSelectorDialog::~BoardSelectorDialog()
 {
+  ui->preview->setScene(0);
+  if(_preview) _manager->release(_preview);
   delete ui;
 }
 
-void BoardSelectorDialog::setBoardFiles(const QList<BoardFile *> &boardFiles)
+QString BoardSelectorDialog::selectedBoardName() const
+{
+  QStandardItem *const item = _model->itemFromIndex(ui->boards->currentIndex());
+  return item ? item->text() : QString();
+}
+
+void BoardSelectorDialog::catalogChanged()
 {
+  const QString selected = selectedBoardName();
+  
   _model->clear();
-  _boards = boardFiles;
-  Q_FOREACH(BoardFile *const board, _boards) {
-    _model->appendRow(new BoardFileItem(board));
+  Q_FOREACH(const BoardFileManager::Entry &entry, _manager->entries()) {
+    _model->appendRow(new QStandardItem(entryIcon(entry), entry.name));
   }
-  ui->boards->selectionModel()->select(_model->index(0, 0), QItemSelectionModel::Select);
-  currentChanged(_model->index(0, 0));
+  
+  QModelIndex current = _model->index(0, 0);
+  const QList<QStandardItem *> matches = _model->findItems(selected);
+  if(!matches.isEmpty()) current = matches.first()->index();
+  ui->boards->setCurrentIndex(current);
 }
 
-const QList<BoardFile *> &BoardSelectorDialog::boardFiles() const
+void BoardSelectorDialog::entryIndexed(const QString &name)
 {
-  return _boards;
+  const BoardFileManager::Entry *const entry = _manager->lookupEntry(name);
+  if(!entry) return;
+  
+  Q_FOREACH(QStandardItem *const item, _model->findItems(name)) {
+    item->setIcon(entryIcon(*entry));
+  }
 }
 
-BoardFile *BoardSelectorDialog::selectedBoardFile() const
+void BoardSelectorDialog::boardLoaded(BoardFile *board)
 {
-  BoardFileItem *const boardItem
-    = BoardFileItem::cast(_model->itemFromIndex(ui->boards->currentIndex()));
-  if(boardItem) return boardItem->board();
-  
-  return 0;
+  // Ignore boards requested for an entry that is no longer selected
+  if(board->name() != selectedBoardName()) return;
+  _manager->retain(board);
+  ui->preview->setScene(board->scene());
+  if(_preview) _manager->release(_preview);
+  _preview = board;
 }
 
 void BoardSelectorDialog::currentChanged(const QModelIndex &index)
 {
-  BoardFileItem *const boardItem = BoardFileItem::cast(_model->itemFromIndex(index));
   ui->preview->setScene(0);
-  if(!boardItem) return;
-  ui->preview->setScene(boardItem->board()->scene());
-}
\ No newline at end of file
+  if(_preview) _manager->release(_preview);
+  _preview = 0;
+  
+  QStandardItem *const item = _model->itemFromIndex(index);
+  if(!item) return;
+  _manager->requestBoardFile(item->text());
+}
@@ -1,4 +1,5 @@
 #include "compile_worker.hpp"
+#include "trace.hpp"
 
 #include <kovanserial/kovan_serial.hpp>
 #include <pcompiler/pcompiler.hpp>
@@ -79,23 +80,36 @@ const QString &CompileWorker::userRoot() const
 void CompileWorker::progress(double fraction)
 {
 	qDebug() << "Progress..." << fraction;
-	if(!m_proto || !m_proto->sendFileActionProgress(false, fraction)) {
+	// Without a connection (e.g. when benchmarked) there is no one to tell
+	if(m_proto && !m_proto->sendFileActionProgress(false, fraction)) {
 		qWarning() << "send file action progress failed.";
 	}
 }
 
 Compiler::OutputList CompileWorker::compile()
 {
+	TRACE_SPAN("compile");
 	using namespace Compiler;
-	using namespace kiss;
-
-	// Extract the archive to a temporary directory
-	m_tempDir = tempPath();
-	if(!m_archive->extract(m_tempDir)) {
+	
+	if(!extract()) {
 		return OutputList() << Output(m_tempDir, 1,
 			QByteArray(), "error: failed to extract KISS Archive");
 	}
 	
+	return compileExtracted();
+}
+
+bool CompileWorker::extract()
+{
+	// Extract the archive to a temporary directory
+	m_tempDir = tempPath();
+	return m_archive->extract(m_tempDir);
+}
+
+Compiler::OutputList CompileWorker::compileExtracted()
+{
+	using namespace Compiler;
+	
 	QStringList extracted;
 	foreach(const QString &file, m_archive->files()) extracted << m_tempDir + "/" + file;
 	qDebug() << "Extracted" << extracted;
@@ -1,4 +1,5 @@
 #include "console_widget.hpp"
+#include "metrics.hpp"
 
 #include <QApplication>
 #include <QKeyEvent>
@@ -49,12 +50,16 @@ void ConsoleWidget::keyPressEvent(QKeyEvent *event)
 
 void ConsoleWidget::readStandardOut()
 {
-	insertPlainText(m_process->readAllStandardOutput());
+	const QByteArray output = m_process->readAllStandardOutput();
+	Metrics::consoleStdoutBytes.add(output.size());
+	insertPlainText(output);
 	moveCursor(QTextCursor::End, QTextCursor::KeepAnchor);
 }
 
 void ConsoleWidget::readStandardErr()
 {
-	insertPlainText(m_process->readAllStandardError());
+	const QByteArray output = m_process->readAllStandardError();
+	Metrics::consoleStderrBytes.add(output.size());
+	insertPlainText(output);
 	moveCursor(QTextCursor::End, QTextCursor::KeepAnchor);
 }
@@ -1,17 +1,22 @@
 #include "kovan_button_provider.hpp"
 
 #include "button.hpp"
+#include "kovan_regs_p.hpp"
 
 Kovan::ButtonProvider::ButtonProvider(KmodSim *sim, QObject *parent)
 	: QObject(parent),
+	m_sim(sim),
 	m_button(sim),
 	m_extraShown(false)
 {
 	reset();
+	m_sim->addRegisterObserver(BUTTON_TEXT_DIRTY, this);
+	m_sim->addRegisterObserver(BUTTON_STATES, this);
 }
 
 Kovan::ButtonProvider::~ButtonProvider()
 {
+	m_sim->removeRegisterObserver(this);
 }
 
 bool Kovan::ButtonProvider::isExtraShown() const
@@ -31,11 +36,19 @@ bool Kovan::ButtonProvider::setPressed(::Button::Type::Id id, bool pressed)
 	return true;
 }
 
+void Kovan::ButtonProvider::registerChanged(Event event, unsigned short address, unsigned short value)
+{
+	// Observers run after the whole datagram, so a new text is complete
+	if(event == ButtonText || event == ButtonStates) refresh();
+}
+
 void Kovan::ButtonProvider::reset()
 {
 	m_button.resetButtons();
 	m_extraShown = false;
 	emit extraShownChanged(false);
+	// The default texts are set behind the controller's back
+	refresh();
 }
 
 void Kovan::ButtonProvider::refresh()
@@ -51,3 +64,18 @@ void Kovan::ButtonProvider::refresh()
 		emit extraShownChanged(m_extraShown);
 	}
 }
+
+void Kovan::ButtonProvider::refreshAll()
+{
+	static const ::Button::Type::Id ids[] = {
+		::Button::Type::A, ::Button::Type::B, ::Button::Type::C,
+		::Button::Type::X, ::Button::Type::Y, ::Button::Type::Z
+	};
+	for(unsigned i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i) {
+		// Clears the dirty bit, as refresh() would have
+		m_button.isTextDirty(ids[i]);
+		emit buttonTextChanged(ids[i], text(ids[i]));
+	}
+	m_extraShown = m_button.isExtraShown();
+	emit extraShownChanged(m_extraShown);
+}
@@ -18,9 +18,15 @@
 
 #include "kovan_kmod_sim.hpp"
 #include "kovan_regs_p.hpp"
+#include "kovan_traffic_log.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
 
 #include <QUdpSocket>
+#include <QTimer>
 #include <QThread>
+#include <QElapsedTimer>
+#include <QVarLengthArray>
 
 #define NUM_RW_REGS 19
 #define RO_REG_OFFSET 0
@@ -28,6 +34,9 @@
 
 #define WRITE_COMMAND_BUFF_SIZE NUM_RW_REGS
 
+// Further wait commands are answered right away, like state requests
+#define MAX_WAITS 64
+
 #define TIMEDIV (1.0 / 13000000) // 13 MHz clock
 #define PWM_PERIOD_RAW 0.02F
 #define SERVO_MAX_RAW 0.0025f
@@ -36,6 +45,18 @@
 #define SERVO_MAX (SERVO_MAX_RAW / TIMEDIV)
 #define SERVO_MIN (SERVO_MIN_RAW / TIMEDIV)
 
+// True once any register a wait watches no longer holds the value the
+// controller last saw
+static bool isWaitOver(const Kovan::WaitCommand &wait, const Kovan::State &state)
+{
+	const unsigned short count = qMin<unsigned short>(wait.count, MAX_WAIT_REGISTERS);
+	for(unsigned short i = 0; i < count; ++i) {
+		const Kovan::WriteCommand &r = wait.registers[i];
+		if(r.addy < TOTAL_REGS && state.t[r.addy] != r.val) return true;
+	}
+	return false;
+}
+
 static const int servos[4] = {
 	SERVO_COMMAND_0,
 	SERVO_COMMAND_1,
@@ -45,9 +66,17 @@ static const int servos[4] = {
 
 Kovan::KmodSim::KmodSim(QObject *parent)
 	: QObject(parent),
-	m_socket(new QUdpSocket(this))
+	m_socket(new QUdpSocket(this)),
+	m_sensors(0),
+	m_log(0),
+	m_answerQueued(false),
+	m_waitTimer(new QTimer(this))
 {
 	reset();
+	m_clock.start();
+	m_waitTimer->setSingleShot(true);
+	m_waitTimer->setTimerType(Qt::PreciseTimer);
+	connect(m_waitTimer, SIGNAL(timeout()), SLOT(answerWaits()));
 	connect(m_socket, SIGNAL(readyRead()), SLOT(readyRead()));
 }
 
@@ -63,7 +92,23 @@ bool Kovan::KmodSim::setup()
 
 void Kovan::KmodSim::reset()
 {
+	QMutexLocker locker(&m_mutex);
 	memset(&m_state, 0, sizeof(State));
+	for(unsigned char i = 0; i < 4; ++i) m_motors[i].reset();
+	if(m_log) logRestore();
+}
+
+void Kovan::KmodSim::save(State &state, MotorSim *motors) const
+{
+	state = m_state;
+	for(unsigned char i = 0; i < 4; ++i) motors[i] = m_motors[i];
+}
+
+void Kovan::KmodSim::restore(const State &state, const MotorSim *motors)
+{
+	m_state = state;
+	for(unsigned char i = 0; i < 4; ++i) m_motors[i] = motors[i];
+	if(m_log) logRestore();
 }
 
 unsigned short Kovan::KmodSim::servoValue(const unsigned char &port) const
@@ -77,13 +122,127 @@ void Kovan::KmodSim::setMotorCounter(unsigned char port, int value)
 	m_state.t[BEMF_0_LOW + port] = (value >> 0) & 0x0000FFFF;
 }
 
+double Kovan::KmodSim::motorOutput(unsigned char port) const
+{
+	if(port > 3) return 0.0;
+	return m_motors[port].output();
+}
+
+double Kovan::KmodSim::motorSpeed(unsigned char port) const
+{
+	if(port > 3) return 0.0;
+	return m_motors[port].velocity() / MOTOR_TICKS_PER_REV;
+}
+
+void Kovan::KmodSim::step(double dt)
+{
+	if(m_log) {
+		logChanges(TrafficLog::ExternalRecord, m_logged);
+		m_log->append(TrafficLog::StepRecord, &dt, sizeof(double));
+	}
+	
+	const unsigned short clear = m_state.t[MOT_BEMF_CLEAR];
+	unsigned short status = 0;
+	for(unsigned char i = 0; i < 4; ++i) {
+		const unsigned short bit = 1 << (3 - i);
+		if(clear & bit) m_motors[i].clearCounter();
+		m_motors[i].step(m_state, i, dt);
+		setMotorCounter(i, m_motors[i].counter());
+		if(m_motors[i].isActive()) status |= bit;
+	}
+	m_state.t[MOT_BEMF_CLEAR] = 0;
+	m_state.t[PID_STATUS] = status;
+	
+	if(m_log) m_logged = m_state;
+}
+
+void Kovan::KmodSim::setSensorProvider(SensorProvider *sensors)
+{
+	QMutexLocker locker(&m_mutex);
+	m_sensors = sensors;
+}
+
+Kovan::SensorProvider *Kovan::KmodSim::sensorProvider() const
+{
+	return m_sensors;
+}
+
+void Kovan::KmodSim::setTrafficLog(TrafficLog *log)
+{
+	QMutexLocker locker(&m_mutex);
+	m_log = log;
+	if(m_log) logRestore();
+}
+
+Kovan::TrafficLog *Kovan::KmodSim::trafficLog() const
+{
+	return m_log;
+}
+
+Kovan::StateResponse Kovan::KmodSim::process(const QByteArray &datagram)
+{
+	QMutexLocker locker(&m_mutex);
+	const StateResponse response = do_packet(datagram);
+	// The writes may be what a held wait is waiting for; readyRead() sends
+	// the replies
+	if(!m_waits.isEmpty()) collectWaits(false);
+	if(m_changes.isEmpty()) return response;
+	
+	// Observers may want the lock themselves
+	const QList<WriteCommand> changes = m_changes;
+	m_changes.clear();
+	QList<QList<RegisterObserver *> > observers;
+	foreach(const WriteCommand &change, changes) observers.append(m_observers[change.addy]);
+	locker.unlock();
+	
+	for(int i = 0; i < changes.size(); ++i) {
+		const WriteCommand &change = changes[i];
+		const RegisterObserver::Event event = registerEvent(change.addy);
+		foreach(RegisterObserver *observer, observers[i]) {
+			observer->registerChanged(event, change.addy, change.val);
+		}
+	}
+	return response;
+}
+
+void Kovan::KmodSim::addRegisterObserver(unsigned short address, RegisterObserver *observer)
+{
+	if(address >= TOTAL_REGS) return;
+	QMutexLocker locker(&m_mutex);
+	if(!m_observers[address].contains(observer)) m_observers[address].append(observer);
+}
+
+void Kovan::KmodSim::removeRegisterObserver(RegisterObserver *observer)
+{
+	QMutexLocker locker(&m_mutex);
+	for(unsigned short i = 0; i < TOTAL_REGS; ++i) m_observers[i].removeAll(observer);
+}
+
+Kovan::RegisterObserver::Event Kovan::KmodSim::registerEvent(unsigned short address)
+{
+	if(address >= BUTTON_TEXT_DIRTY && address <= BUTTON_Z_TEXT_END) return RegisterObserver::ButtonText;
+	if(address == BUTTON_STATES) return RegisterObserver::ButtonStates;
+	if(address == PID_MODES) return RegisterObserver::PidMode;
+	if((address >= MOTOR_PWM_0 && address <= MOTOR_PWM_3) || address == MOTOR_DRIVE_CODE_T) {
+		return RegisterObserver::MotorPwm;
+	}
+	if(address >= SERVO_COMMAND_0 && address <= SERVO_COMMAND_3) return RegisterObserver::ServoCommand;
+	return RegisterObserver::OtherRegister;
+}
+
 Kovan::State &Kovan::KmodSim::state()
 {
 	return m_state;
 }
 
+QMutex *Kovan::KmodSim::mutex() const
+{
+	return &m_mutex;
+}
+
 void Kovan::KmodSim::readyRead()
 {
+	TRACE_SPAN("kmod.readyRead");
 	while(m_socket->hasPendingDatagrams()) {
 		QByteArray datagram;
 		datagram.resize(m_socket->pendingDatagramSize());
@@ -92,20 +251,106 @@ void Kovan::KmodSim::readyRead()
 		quint16 senderPort;
 		m_socket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort);
 		
-		Kovan::StateResponse s = do_packet(datagram);
-		if(!s.hasState) continue;
+		QElapsedTimer latency;
+		latency.start();
+		Kovan::StateResponse s = process(datagram);
+		
+		if(s.hasWait && !isWaitOver(s.wait, s.state) && s.wait.timeout) {
+			Wait wait;
+			wait.sender = sender;
+			wait.senderPort = senderPort;
+			wait.command = s.wait;
+			wait.deadline = m_clock.elapsed() + s.wait.timeout;
+			// answerWaits() below arms the time-out
+			QMutexLocker locker(&m_mutex);
+			if(m_waits.size() < MAX_WAITS) {
+				m_waits.append(wait);
+				continue;
+			}
+		}
+		if(!s.hasState && !s.hasWait) continue;
 		
 		m_socket->writeDatagram(reinterpret_cast<const char *>(&s.state), sizeof(State), sender, senderPort);
+		Metrics::kmodResponseLatency.record(latency.nsecsElapsed());
 	}
 	
+	answerWaits();
 	emit stateChanged(m_state);
 }
 
-Kovan::StateResponse Kovan::KmodSim::do_packet(const QByteArray &datagram)
+void Kovan::KmodSim::serviceWaits()
+{
+	if(!collectWaits(true) || m_answerQueued) return;
+	m_answerQueued = true;
+	QMetaObject::invokeMethod(this, "answerWaits", Qt::QueuedConnection);
+}
+
+bool Kovan::KmodSim::collectWaits(const bool sample)
+{
+	if(!m_waits.isEmpty()) {
+		// Sensors are only evaluated on request, so nothing else would notice
+		// e.g. a touch sensor being pressed
+		if(sample && m_sensors) {
+			m_sensors->sample(m_state);
+			if(m_log) {
+				logChanges(TrafficLog::ExternalRecord, m_logged);
+				m_logged = m_state;
+			}
+		}
+		
+		const qint64 now = m_clock.elapsed();
+		for(int i = 0; i < m_waits.size();) {
+			const Wait &wait = m_waits[i];
+			if(now < wait.deadline && !isWaitOver(wait.command, m_state)) {
+				++i;
+				continue;
+			}
+			Reply reply;
+			reply.sender = wait.sender;
+			reply.senderPort = wait.senderPort;
+			reply.state = m_state;
+			m_replies.append(reply);
+			m_waits.removeAt(i);
+		}
+	}
+	return !m_replies.isEmpty();
+}
+
+void Kovan::KmodSim::answerWaits()
 {
+	QMutexLocker locker(&m_mutex);
+	m_answerQueued = false;
+	// Also catches time-outs while the simulation is not ticking
+	collectWaits(true);
+	const QList<Reply> replies = m_replies;
+	m_replies.clear();
+	qint64 next = -1;
+	foreach(const Wait &wait, m_waits) {
+		if(next < 0 || wait.deadline < next) next = wait.deadline;
+	}
+	locker.unlock();
+	
+	foreach(const Reply &reply, replies) {
+		m_socket->writeDatagram(reinterpret_cast<const char *>(&reply.state), sizeof(State),
+			reply.sender, reply.senderPort);
+	}
+	
+	if(next < 0) m_waitTimer->stop();
+	else m_waitTimer->start(static_cast<int>(qMax<qint64>(0, next - m_clock.elapsed())));
+}
 
+Kovan::StateResponse Kovan::KmodSim::do_packet(const QByteArray &datagram)
+{
+	TRACE_SPAN("kmod.packet");
+	Metrics::kmodPackets.add();
+	
+	if(m_log) {
+		logChanges(TrafficLog::ExternalRecord, m_logged);
+		m_log->append(TrafficLog::DatagramRecord, datagram.constData(), datagram.size());
+	}
 
 	int have_state_request = 0;
+	int have_wait = 0;
 	int num_write_commands = 0;
 
 	StateResponse response;
@@ -118,6 +363,8 @@ Kovan::StateResponse Kovan::KmodSim::do_packet(const QByteArray &datagram)
 		return response; // Error: Packet is too small?
 	}
 	
+	QVarLengthArray<WriteCommand, WRITE_COMMAND_BUFF_SIZE> writes;
+	
 	Packet *packet = (Packet *)datagram.data();
 	for(unsigned short i = 0; i < packet->num; ++i) {
 		Command cmd = packet->commands[i];
@@ -128,22 +375,72 @@ Kovan::StateResponse Kovan::KmodSim::do_packet(const QByteArray &datagram)
 			have_state_request = 1;
 			break;
 		
+		case WaitCommandType:
+			have_wait = 1;
+			memcpy(&response.wait, cmd.data, sizeof(WaitCommand));
+			break;
+		
 		case WriteCommandType:
 			w_cmd = (WriteCommand *) &(cmd.data);
 			if(w_cmd->addy >= TOTAL_REGS) break;
+			if(!m_observers[w_cmd->addy].isEmpty() && m_state.t[w_cmd->addy] != w_cmd->val) {
+				m_changes.append(*w_cmd);
+			}
 			m_state.t[w_cmd->addy] = w_cmd->val;
+			if(m_log) writes.append(*w_cmd);
 			break;
 		
 		default: break;
 		}
 	}
 
-	if(have_state_request) {
-		Kovan::StateResponse s;
-		s.hasState = 1;
-		s.state = m_state;
-		response = s;
+	if(m_log && !writes.isEmpty()) {
+		m_log->append(TrafficLog::WritesRecord, writes.constData(), writes.size() * sizeof(WriteCommand));
+	}
+
+	if(have_state_request || have_wait) {
+		if(m_sensors) {
+			const State before = m_state;
+			m_sensors->sample(m_state);
+			if(m_log) logChanges(TrafficLog::SensorsRecord, before);
+		}
+		
+		response.state = m_state;
+		// When a wait is answered depends on the clock, so only immediate
+		// responses are recorded for replay
+		if(have_wait) response.hasWait = 1;
+		else {
+			response.hasState = 1;
+			if(m_log) m_log->append(TrafficLog::ResponseRecord, &m_state, sizeof(State));
+		}
 	}
+	
+	if(m_log) m_logged = m_state;
 
 	return response;
 }
+
+void Kovan::KmodSim::logRestore()
+{
+	char data[sizeof(State) + sizeof(m_motors)];
+	memcpy(data, &m_state, sizeof(State));
+	memcpy(data + sizeof(State), m_motors, sizeof(m_motors));
+	m_log->append(TrafficLog::RestoreRecord, data, sizeof(data));
+	m_logged = m_state;
+}
+
+void Kovan::KmodSim::logChanges(const int type, const State &before)
+{
+	if(!memcmp(&before, &m_state, sizeof(State))) return;
+	
+	QVarLengthArray<WriteCommand, TOTAL_REGS> changes;
+	for(unsigned short i = 0; i < TOTAL_REGS; ++i) {
+		if(before.t[i] == m_state.t[i]) continue;
+		WriteCommand w;
+		w.addy = i;
+		w.val = m_state.t[i];
+		changes.append(w);
+	}
+	
+	m_log->append(static_cast<TrafficLog::RecordType>(type), changes.constData(), changes.size() * sizeof(WriteCommand));
+}
@@ -0,0 +1,140 @@
+/**************************************************************************
+ * ks2 - A 2D simulator for the Kovan Robot Controller                    *
+ * Copyright (C) 2012 KISS Institute for Practical Robotics               *
+ *                                                                        *
+ * This program is free software: you can redistribute it and/or modify   *
+ * it under the terms of the GNU General Public License as published by   *
+ * the Free Software Foundation, either version 3 of the License, or      *
+ * (at your option) any later version.                                    *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ **************************************************************************/
+
+#include "kovan_motor_sim.hpp"
+#include "kovan_regs_p.hpp"
+
+#include <QtGlobal>
+#include <cmath>
+
+// Fallback gains used while the controller has not written PID_* registers
+#define DEFAULT_P_GAIN 4.0
+#define DEFAULT_I_GAIN 0.0
+#define DEFAULT_D_GAIN 0.0
+
+Kovan::MotorSim::MotorSim()
+{
+	reset();
+}
+
+void Kovan::MotorSim::reset()
+{
+	m_position = 0.0;
+	m_velocity = 0.0;
+	m_output = 0.0;
+	m_integral = 0.0;
+	m_active = false;
+}
+
+void Kovan::MotorSim::clearCounter()
+{
+	m_position = 0.0;
+	m_integral = 0.0;
+}
+
+void Kovan::MotorSim::step(const State &state, unsigned char channel, double dt)
+{
+	if(dt <= 0.0) return;
+	
+	m_output = qBound(-1.0, targetVelocity(state, channel, dt) / MOTOR_MAX_SPEED, 1.0);
+	
+	// The motor approaches the free running speed of the applied duty cycle
+	const double alpha = dt / (MOTOR_TIME_CONSTANT + dt);
+	m_velocity += (m_output * MOTOR_MAX_SPEED - m_velocity) * alpha;
+	m_position += m_velocity * dt;
+}
+
+int Kovan::MotorSim::counter() const
+{
+	return static_cast<int>(m_position);
+}
+
+double Kovan::MotorSim::velocity() const
+{
+	return m_velocity;
+}
+
+double Kovan::MotorSim::output() const
+{
+	return m_output;
+}
+
+bool Kovan::MotorSim::isActive() const
+{
+	return m_active;
+}
+
+double Kovan::MotorSim::targetVelocity(const State &state, unsigned char channel, double dt)
+{
+	const unsigned char shift = (3 - channel) * 2;
+	const unsigned char mode = (state.t[PID_MODES] >> shift) & 0x3;
+	
+	if(mode == 0) { // pwm
+		m_integral = 0.0;
+		m_active = false;
+		const unsigned char code = (state.t[MOTOR_DRIVE_CODE_T] >> shift) & 0x3;
+		double duty = state.t[MOTOR_PWM_0 + channel] / 2600.0;
+		if(duty > 1.0) duty = 1.0;
+		if(code == 1) duty = -duty;
+		else if(code != 2) duty = 0.0;
+		return duty * MOTOR_MAX_SPEED;
+	}
+	
+	const int goalSpeed = static_cast<int>((unsigned int)state.t[GOAL_SPEED_0_HIGH + channel] << 16
+		| state.t[GOAL_SPEED_0_LOW + channel]);
+	
+	if(mode == 2) { // speed
+		m_integral = 0.0;
+		m_active = false;
+		return goalSpeed;
+	}
+	
+	// position (1) and position at speed (3)
+	const int goalPos = static_cast<int>((unsigned int)state.t[GOAL_POS_0_HIGH + channel] << 16
+		| state.t[GOAL_POS_0_LOW + channel]);
+	const double error = goalPos - m_position;
+	
+	if(std::fabs(error) < MOTOR_GOAL_EPSILON
+		|| (mode == 3 && ((error < 0 && goalSpeed > 0) || (error > 0 && goalSpeed < 0)))) {
+		m_integral = 0.0;
+		m_active = false;
+		return 0.0;
+	}
+	m_active = true;
+	
+	const double p = gain(state, PID_PN_0 + channel, PID_PD_0 + channel, DEFAULT_P_GAIN);
+	const double i = gain(state, PID_IN_0 + channel, PID_ID_0 + channel, DEFAULT_I_GAIN);
+	const double d = gain(state, PID_DN_0 + channel, PID_DD_0 + channel, DEFAULT_D_GAIN);
+	
+	// The goal is fixed, so the derivative of the error is the negated velocity
+	double velocity = p * error + i * m_integral - d * m_velocity;
+	
+	double limit = MOTOR_MAX_SPEED;
+	if(mode == 3) limit = qMin(limit, (double)qAbs(goalSpeed));
+	
+	// Only integrate while unsaturated to avoid windup
+	if(velocity < limit && velocity > -limit) m_integral += error * dt;
+	
+	return qBound(-limit, velocity, limit);
+}
+
+double Kovan::MotorSim::gain(const State &state, int num, int den, double fallback)
+{
+	if(!state.t[den]) return fallback;
+	return static_cast<short>(state.t[num]) / static_cast<double>(state.t[den]);
+}
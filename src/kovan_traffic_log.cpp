@@ -0,0 +1,219 @@
+/**************************************************************************
+ * ks2 - A 2D simulator for the Kovan Robot Controller                    *
+ * Copyright (C) 2012 KISS Institute for Practical Robotics               *
+ *                                                                        *
+ * This program is free software: you can redistribute it and/or modify   *
+ * it under the terms of the GNU General Public License as published by   *
+ * the Free Software Foundation, either version 3 of the License, or      *
+ * (at your option) any later version.                                    *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ **************************************************************************/
+
+#include "kovan_traffic_log.hpp"
+#include "kovan_protocol_p.hpp"
+#include "kovan_motor_sim.hpp"
+
+#include <QDebug>
+#include <cstring>
+
+// The log file grows (and is remapped) in steps of this many bytes
+#define LOG_CHUNK_SIZE (4 << 20)
+
+static quint64 padded(const quint64 size)
+{
+	return (size + 7) & ~quint64(7);
+}
+
+Kovan::TrafficLog::TrafficLog()
+	: m_data(0),
+	m_size(0),
+	m_capacity(0)
+{
+}
+
+Kovan::TrafficLog::~TrafficLog()
+{
+	close();
+}
+
+bool Kovan::TrafficLog::open(const QString &path)
+{
+	close();
+	
+	m_file.setFileName(path);
+	if(!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+		qWarning() << "Failed to open traffic log" << path << m_file.errorString();
+		return false;
+	}
+	
+	if(!reserve(sizeof(FileHeader))) return false;
+	
+	FileHeader header;
+	header.magic = Magic;
+	header.version = Version;
+	header.stateSize = sizeof(State);
+	header.motorSize = sizeof(MotorSim);
+	memcpy(m_data, &header, sizeof(FileHeader));
+	m_size = sizeof(FileHeader);
+	
+	m_clock.start();
+	return true;
+}
+
+void Kovan::TrafficLog::close()
+{
+	if(!m_file.isOpen()) return;
+	
+	if(m_data) m_file.unmap(m_data);
+	m_data = 0;
+	
+	// Drop the unused tail of the last chunk
+	m_file.resize(m_size);
+	m_file.close();
+	
+	m_size = 0;
+	m_capacity = 0;
+}
+
+bool Kovan::TrafficLog::isOpen() const
+{
+	return m_data;
+}
+
+QString Kovan::TrafficLog::fileName() const
+{
+	return m_file.fileName();
+}
+
+quint64 Kovan::TrafficLog::size() const
+{
+	return m_size;
+}
+
+void Kovan::TrafficLog::append(const RecordType type, const void *data, const quint32 size)
+{
+	if(!m_data) return;
+	
+	const quint64 total = sizeof(RecordHeader) + padded(size);
+	if(!reserve(total)) return;
+	
+	RecordHeader header;
+	header.type = type;
+	header.size = size;
+	header.time = m_clock.nsecsElapsed();
+	
+	// New space comes from resizing the file and is already zeroed, which
+	// takes care of the padding
+	uchar *const out = m_data + m_size;
+	memcpy(out, &header, sizeof(RecordHeader));
+	memcpy(out + sizeof(RecordHeader), data, size);
+	m_size += total;
+}
+
+bool Kovan::TrafficLog::reserve(const quint64 size)
+{
+	if(m_size + size <= m_capacity) return true;
+	
+	quint64 capacity = m_capacity + LOG_CHUNK_SIZE;
+	while(capacity < m_size + size) capacity += LOG_CHUNK_SIZE;
+	
+	if(m_data) m_file.unmap(m_data);
+	m_data = 0;
+	
+	if(m_file.resize(capacity)) m_data = m_file.map(0, capacity);
+	if(!m_data) {
+		qWarning() << "Failed to grow traffic log" << m_file.fileName() << m_file.errorString();
+		m_file.resize(m_size);
+		m_file.close();
+		m_size = 0;
+		m_capacity = 0;
+		return false;
+	}
+	
+	m_capacity = capacity;
+	return true;
+}
+
+Kovan::TrafficLogReader::TrafficLogReader()
+	: m_data(0),
+	m_size(0),
+	m_offset(0)
+{
+}
+
+Kovan::TrafficLogReader::~TrafficLogReader()
+{
+	close();
+}
+
+bool Kovan::TrafficLogReader::open(const QString &path)
+{
+	close();
+	
+	m_file.setFileName(path);
+	if(!m_file.open(QIODevice::ReadOnly)) {
+		qWarning() << "Failed to open traffic log" << path << m_file.errorString();
+		return false;
+	}
+	
+	const qint64 size = m_file.size();
+	if(size < (qint64)sizeof(TrafficLog::FileHeader)) {
+		qWarning() << path << "is not a traffic log";
+		close();
+		return false;
+	}
+	
+	m_data = m_file.map(0, size);
+	if(!m_data) {
+		qWarning() << "Failed to map traffic log" << path << m_file.errorString();
+		close();
+		return false;
+	}
+	
+	TrafficLog::FileHeader header;
+	memcpy(&header, m_data, sizeof(TrafficLog::FileHeader));
+	if(header.magic != TrafficLog::Magic || header.version != TrafficLog::Version
+		|| header.stateSize != sizeof(State) || header.motorSize != sizeof(MotorSim)) {
+		qWarning() << path << "is not a compatible traffic log";
+		close();
+		return false;
+	}
+	
+	m_size = size;
+	m_offset = sizeof(TrafficLog::FileHeader);
+	return true;
+}
+
+void Kovan::TrafficLogReader::close()
+{
+	if(m_data) m_file.unmap(const_cast<uchar *>(m_data));
+	m_data = 0;
+	m_file.close();
+	m_size = 0;
+	m_offset = 0;
+}
+
+bool Kovan::TrafficLogReader::next(TrafficLog::RecordHeader &header, const uchar *&payload)
+{
+	if(!m_data || m_offset + sizeof(TrafficLog::RecordHeader) > m_size) return false;
+	
+	memcpy(&header, m_data + m_offset, sizeof(TrafficLog::RecordHeader));
+	if(header.type == TrafficLog::EndRecord) return false;
+	
+	const quint64 total = sizeof(TrafficLog::RecordHeader) + padded(header.size);
+	if(m_offset + total > m_size) {
+		qWarning() << "Traffic log" << m_file.fileName() << "is truncated";
+		return false;
+	}
+	
+	payload = m_data + m_offset + sizeof(TrafficLog::RecordHeader);
+	m_offset += total;
+	return true;
+}
@@ -0,0 +1,172 @@
+/**************************************************************************
+ * ks2 - A 2D simulator for the Kovan Robot Controller                    *
+ * Copyright (C) 2012 KISS Institute for Practical Robotics               *
+ *                                                                        *
+ * This program is free software: you can redistribute it and/or modify   *
+ * it under the terms of the GNU General Public License as published by   *
+ * the Free Software Foundation, either version 3 of the License, or      *
+ * (at your option) any later version.                                    *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ **************************************************************************/
+
+#include "kovan_traffic_replay.hpp"
+#include "kovan_traffic_log.hpp"
+#include "kovan_motor_sim.hpp"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <cstring>
+
+Kovan::TrafficReplay::TrafficReplay()
+	: m_datagram(0),
+	m_datagramSize(0),
+	m_datagramTime(0),
+	m_sensors(0),
+	m_sensorCount(0),
+	m_response(0)
+{
+}
+
+bool Kovan::TrafficReplay::run(const QString &path, Result &result)
+{
+	memset(&result, 0, sizeof(Result));
+	result.firstDivergenceNs = -1;
+	result.firstDivergentRegister = -1;
+	
+	TrafficLogReader reader;
+	if(!reader.open(path)) return false;
+	
+	// Never bound, so the engine only sees what the log feeds it
+	KmodSim sim;
+	sim.setSensorProvider(this);
+	
+	m_datagram = 0;
+	
+	TrafficLog::RecordHeader header;
+	const uchar *payload = 0;
+	while(reader.next(header, payload)) {
+		result.recordedNs = header.time;
+		
+		switch(header.type) {
+		case TrafficLog::WritesRecord:
+			// Derived from the datagram; only there for reading the log
+			continue;
+		
+		case TrafficLog::SensorsRecord:
+			m_sensors = reinterpret_cast<const WriteCommand *>(payload);
+			m_sensorCount = header.size / sizeof(WriteCommand);
+			continue;
+		
+		case TrafficLog::ResponseRecord:
+			if(header.size == sizeof(State)) m_response = reinterpret_cast<const State *>(payload);
+			continue;
+		
+		default: break;
+		}
+		
+		// Anything else ends the records of the previous datagram
+		flush(sim, result);
+		
+		switch(header.type) {
+		case TrafficLog::DatagramRecord:
+			m_datagram = payload;
+			m_datagramSize = header.size;
+			m_datagramTime = header.time;
+			break;
+		
+		case TrafficLog::StepRecord: {
+			if(header.size != sizeof(double)) break;
+			double dt;
+			memcpy(&dt, payload, sizeof(double));
+			
+			QElapsedTimer timer;
+			timer.start();
+			sim.mutex()->lock();
+			sim.step(dt);
+			sim.mutex()->unlock();
+			result.engineNs += timer.nsecsElapsed();
+			++result.steps;
+			break;
+		}
+		
+		case TrafficLog::ExternalRecord: {
+			const WriteCommand *const writes = reinterpret_cast<const WriteCommand *>(payload);
+			QMutexLocker locker(sim.mutex());
+			for(quint32 i = 0; i < header.size / sizeof(WriteCommand); ++i) {
+				if(writes[i].addy < TOTAL_REGS) sim.state().t[writes[i].addy] = writes[i].val;
+			}
+			break;
+		}
+		
+		case TrafficLog::RestoreRecord: {
+			if(header.size != sizeof(State) + 4 * sizeof(MotorSim)) break;
+			State state;
+			MotorSim motors[4];
+			memcpy(&state, payload, sizeof(State));
+			memcpy(motors, payload + sizeof(State), 4 * sizeof(MotorSim));
+			QMutexLocker locker(sim.mutex());
+			sim.restore(state, motors);
+			break;
+		}
+		
+		default: break;
+		}
+	}
+	flush(sim, result);
+	
+	sim.setSensorProvider(0);
+	return true;
+}
+
+void Kovan::TrafficReplay::sample(State &state)
+{
+	for(quint32 i = 0; i < m_sensorCount; ++i) {
+		if(m_sensors[i].addy < TOTAL_REGS) state.t[m_sensors[i].addy] = m_sensors[i].val;
+	}
+}
+
+void Kovan::TrafficReplay::flush(KmodSim &sim, Result &result)
+{
+	if(!m_datagram) return;
+	
+	const QByteArray datagram = QByteArray::fromRawData(reinterpret_cast<const char *>(m_datagram), m_datagramSize);
+	
+	QElapsedTimer timer;
+	timer.start();
+	const StateResponse response = sim.process(datagram);
+	result.engineNs += timer.nsecsElapsed();
+	++result.datagrams;
+	
+	if(m_response) {
+		++result.responses;
+		
+		int reg = -1;
+		if(!response.hasState) reg = TOTAL_REGS;
+		else {
+			for(int i = 0; i < TOTAL_REGS && reg < 0; ++i) {
+				if(response.state.t[i] != m_response->t[i]) reg = i;
+			}
+		}
+		
+		if(reg >= 0) {
+			if(!result.divergences) {
+				result.firstDivergenceNs = m_datagramTime;
+				result.firstDivergentRegister = reg;
+			}
+			++result.divergences;
+		}
+	}
+	
+	m_datagram = 0;
+	m_sensors = 0;
+	m_sensorCount = 0;
+	m_response = 0;
+}
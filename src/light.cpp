@@ -3,13 +3,16 @@
 #include <QGraphicsSceneMouseEvent>
 #include <QRadialGradient>
 #include <QPen>
+#include <QMutexLocker>
 
 Light::Light()
 	: QGraphicsEllipseItem(-5, -5, 10, 10),
 	m_grabbed(false),
 	m_gradient(new QGraphicsEllipseItem(-50, -50, 100, 100, this)),
-	m_on(true)
+	m_on(true),
+	m_stateOn(true)
 {
+	setFlag(QGraphicsItem::ItemSendsGeometryChanges);
 	m_gradient->setPen(QPen(Qt::transparent));
 	
 	setPen(QPen(Qt::black));
@@ -33,6 +36,22 @@ void Light::reset()
 	setOn(false);
 }
 
+void Light::sensorState(QPointF &pos, bool &on) const
+{
+	QMutexLocker locker(&m_stateMutex);
+	pos = m_statePos;
+	on = m_stateOn;
+}
+
+QVariant Light::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+	if(change == ItemPositionHasChanged) {
+		QMutexLocker locker(&m_stateMutex);
+		m_statePos = value.toPointF();
+	}
+	return QGraphicsEllipseItem::itemChange(change, value);
+}
+
 void Light::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
 	m_grabbed = true;
@@ -57,6 +76,10 @@ void Light::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
 void Light::setOn(bool on)
 {
 	m_on = on;
+	QMutexLocker locker(&m_stateMutex);
+	m_stateOn = on;
+	locker.unlock();
+	
 	QRadialGradient gradient(0, 0, 50);
 	QColor color = m_on ? QColor(255, 215, 0, 127) : QColor(50, 50, 50, 100);
 	gradient.setColorAt(0.0, color);
@@ -22,6 +22,10 @@
 #include <QDir>
 #include "board_file_manager.hpp"
 #include "board_selector_dialog.hpp"
+#include "kovan_traffic_replay.hpp"
+
+#include <QCommandLineParser>
+#include <QTextStream>
 
 #ifdef _MSC_VER
 #pragma comment(linker, "/ENTRY:mainCRTStartup")
@@ -35,6 +39,35 @@ int main(int argc, char *argv[])
 	QApplication::setOrganizationDomain("kipr.org");
 	QApplication::setApplicationName("ks2");
   
+	QCommandLineParser parser;
+	parser.addHelpOption();
+	QCommandLineOption replay("replay",
+		QApplication::translate("main", "Replays a register traffic log without the GUI and reports whether it diverges."),
+		QApplication::translate("main", "log"));
+	parser.addOption(replay);
+	parser.process(app);
+	
+	// Exits with 0 if every response matched the recording, 1 if any diverged
+	if(parser.isSet(replay)) {
+		Kovan::TrafficReplay harness;
+		Kovan::TrafficReplay::Result result;
+		if(!harness.run(parser.value(replay), result)) return 2;
+		
+		QTextStream out(stdout);
+		out << result.datagrams << " datagrams, " << result.steps << " steps over "
+			<< result.recordedNs / 1e9 << " s recorded" << endl;
+		out << "Register engine: " << result.engineNs / 1e6 << " ms";
+		if(result.datagrams + result.steps) out << ", " << result.engineNs / qint64(result.datagrams + result.steps) << " ns per call";
+		out << endl;
+		out << result.divergences << " of " << result.responses << " responses diverged";
+		if(result.divergences) {
+			out << ", first at " << result.firstDivergenceNs / 1e9 << " s in register "
+				<< result.firstDivergentRegister;
+		}
+		out << endl;
+		return result.divergences ? 1 : 0;
+	}
+  
 #ifdef Q_OS_MAC
 	QDir::setCurrent(QApplication::applicationDirPath() + "/../");
 #else
@@ -23,16 +23,24 @@
 
 #include "kovan_kmod_sim.hpp"
 #include "kovan_button_provider.hpp"
+#include "kovan_traffic_log.hpp"
 #include "robot.hpp"
 #include "board_selector_dialog.hpp"
 #include "light.hpp"
 #include "simulator.hpp"
 #include "board_file.hpp"
+#include "walls.hpp"
 #include "server_thread.hpp"
 #include "kovan_regs_p.hpp"
 #include "heartbeat.hpp"
+#include "metrics_server.hpp"
 #include "mapping_model.hpp"
 #include "port_configuration.hpp"
+#include "robot_sensors.hpp"
+#include "simulation_thread.hpp"
+#include "telemetry.hpp"
+#include "trace.hpp"
+#include "register_readout.hpp"
 
 #ifdef WIN32
 #include <winsock2.h>
@@ -45,7 +53,9 @@
 
 #include <QTimer>
 #include <QGraphicsItem>
+#include <QGraphicsScene>
 #include <QMessageBox>
+#include <QFileDialog>
 #include <QThreadPool>
 #include <QProcess>
 #include <QDir>
@@ -56,18 +66,29 @@
 
 MainWindow::MainWindow(QWidget *parent)
 	: QMainWindow(parent),
+  _board(0),
+  _walls(0),
+  _worldPending(false),
 	ui(new Ui::MainWindow),
+  _scene(new QGraphicsScene(this)),
   _analogs(new MappingModel),
   _digitals(new MappingModel),
 	m_robot(new Robot),
 	m_light(new Light),
+  _sensors(new RobotSensors(m_robot, m_light)),
+  _simulation(0),
+  _telemetry(new Telemetry),
 	m_buttonProvider(0),
 	m_kmod(new Kovan::KmodSim(this)),
+	m_trafficLog(new Kovan::TrafficLog),
 	m_heartbeat(new Heartbeat(this)),
+	m_metrics(new MetricsServer(this)),
 	m_process(0),
   _timer(new QTimer(this))
 {  
 	ui->setupUi(this);
+	
+	_simulation = new SimulationThread(m_kmod, m_robot, _sensors, this);
   
 	TcpServer *serial = new TcpServer;
   serial->setConnectionRestriction(TcpServer::OnlyLocal);
@@ -97,10 +118,13 @@ MainWindow::MainWindow(QWidget *parent)
   
   connect(m_server, SIGNAL(newBoard(QString)), SLOT(newBoard(QString)));
   
-  ui->sim->setViewportUpdateMode(QGraphicsView::NoViewportUpdate);
+  ui->sim->setScene(_scene);
   
+  connect(&_boardFileManager, SIGNAL(boardLoaded(BoardFile *)), SLOT(boardLoaded(BoardFile *)));
+  connect(&_boardFileManager, SIGNAL(boardChanged(BoardFile *)), SLOT(boardChanged(BoardFile *)));
   _boardFileManager.addLocation(QDir::currentPath());
   _boardFileManager.addLocation(Compiler::RootManager(m_server->userRoot()).boardPath());
+  _boardFileManager.setThumbnailPath(QDir(m_server->userRoot()).filePath("cache/thumbnails"));
   _boardFileManager.reload();
   
   _analogs->setMapping(PortConfiguration::currentAnalogMapping(), QStringList()
@@ -109,7 +133,10 @@ MainWindow::MainWindow(QWidget *parent)
     << tr("Right Reflectance"));
   _digitals->setMapping(PortConfiguration::currentDigitalMapping(), QStringList()
     << tr("Left Touch") << tr("Right Touch"));
-  _motors = PortConfiguration::currentMotorMapping();
+  setMotorMapping(PortConfiguration::currentMotorMapping());
+  _sensors->setAnalogMapping(_analogs->mapping());
+  _sensors->setDigitalMapping(_digitals->mapping());
+  m_kmod->setSensorProvider(_sensors);
   
   ui->analogs->setModel(_analogs);
   ui->digitals->setModel(_digitals);
@@ -139,11 +166,34 @@ MainWindow::MainWindow(QWidget *parent)
 	
 	// connect(m_kmod, SIGNAL(stateChanged(State)), SLOT(update()));
 	
+  _scene->setSceneRect(0.0, 0.0, 275.0, 275.0);
+  putRobotAndLight();
   updateBoard();
-	ui->sim->setSceneRect(0.0, 0.0, 275.0, 275.0);
 	
+	QSettings settings;
+	settings.beginGroup("simulation");
+	_simulation->setRate(settings.value("rate", 1000).toUInt());
+	settings.endGroup();
+	
+	// The scanning rangefinder is off unless beams are configured
+	settings.beginGroup("rangefinder");
+	Rangefinder *const rangefinder = m_robot->rangefinder();
+	rangefinder->setRange(settings.value("range", 150.0).toDouble());
+	rangefinder->setFieldOfView(settings.value("field_of_view", 360.0).toDouble());
+	rangefinder->setBeams(settings.value("beams", 0).toUInt());
+	settings.endGroup();
+	
+	// One socket per instance, so several simulators can share a lab server
+	settings.beginGroup("metrics");
+	if(settings.value("enabled", true).toBool()) {
+		m_metrics->listen(settings.value("socket",
+			QString("ks2-%1.metrics").arg(QCoreApplication::applicationPid())).toString());
+	}
+	settings.endGroup();
+	
+	// The display samples the simulation at roughly 30 Hz
 	connect(_timer, SIGNAL(timeout()), SLOT(update()));
-	_timer->start(50);
+	_timer->start(33);
 	
 	connect(ui->a, SIGNAL(pressed()), SLOT(buttonPressed()));
 	connect(ui->b, SIGNAL(pressed()), SLOT(buttonPressed()));
@@ -166,9 +216,23 @@ MainWindow::MainWindow(QWidget *parent)
   connect(ui->actionSelectBoard, SIGNAL(triggered()), SLOT(selectBoard()));
   connect(ui->actionAbout, SIGNAL(triggered()), SLOT(about()));
 
+	connect(ui->actionSaveCheckpoint, SIGNAL(triggered()), SLOT(saveCheckpoint()));
+	connect(ui->actionRestoreCheckpoint, SIGNAL(triggered()), SLOT(restoreCheckpoint()));
+	ui->actionRestoreCheckpoint->setEnabled(false);
+	connect(ui->actionRecordTraffic, SIGNAL(toggled(bool)), SLOT(recordTraffic(bool)));
+	connect(ui->actionRecordTelemetry, SIGNAL(toggled(bool)), SLOT(recordTelemetry(bool)));
+	connect(ui->actionTrace, SIGNAL(toggled(bool)), SLOT(trace(bool)));
+	connect(ui->actionSaveTrace, SIGNAL(triggered()), SLOT(saveTrace()));
+
 	bool ret = m_kmod->setup();
 	if (!ret) qWarning() << "m_kmod->setup() failed.  (main_window.cpp : " << __LINE__ << ")";
 	
+	// What Reset returns to
+	_start = saveWorld();
+	_simulation->start(QThread::TimeCriticalPriority);
+	
+	for(unsigned short i = SERVO_COMMAND_0; i <= SERVO_COMMAND_3; ++i) m_kmod->addRegisterObserver(i, this);
+	
 	m_buttonProvider = new Kovan::ButtonProvider(m_kmod, this);
 	ui->extras->connect(m_buttonProvider, SIGNAL(extraShownChanged(bool)), SLOT(setVisible(bool)));
 	connect(m_buttonProvider,
@@ -184,7 +248,17 @@ MainWindow::~MainWindow()
 {
 	stop();
 	m_server->stop();
+	_simulation->stop();
+	// m_kmod is destroyed before its other children
+	delete m_buttonProvider;
+	m_kmod->removeRegisterObserver(this);
+	delete _telemetry;
+	m_kmod->setTrafficLog(0);
+	delete m_trafficLog;
+	m_kmod->setSensorProvider(0);
+	delete _sensors;
 	delete m_robot;
+	delete _walls;
 	delete ui;
 }
 
@@ -253,183 +327,31 @@ void MainWindow::textChanged(::Button::Type::Id id, const QString &text)
 
 void MainWindow::update()
 {
-  if(!m_process) {
-    _timer->setInterval(100);
-    ui->sim->update();
-    return;
-  } else {
-    _timer->setInterval(50);
-  }
-	
-	m_buttonProvider->refresh();
-	
-	Kovan::State &s = m_kmod->state();
-
-	static const int motors[4] = {
-		MOTOR_PWM_0,
-		MOTOR_PWM_1,
-		MOTOR_PWM_2,
-		MOTOR_PWM_3
-	};
-	
-	static const int servos[4] = {
-		SERVO_COMMAND_0,
-		SERVO_COMMAND_1,
-		SERVO_COMMAND_2,
-		SERVO_COMMAND_3
-	};
-
-	unsigned short modes = s.t[PID_MODES];
-
-	static const int GOAL_EPSILON = 20;
-	static const int MOTOR_SCALE  = 500;
-
-	for(int i = 0; i < 4; ++i) {
-		unsigned char mode = (modes >> ((3 - i) * 2)) & 0x3;
-		double val = 0.0;
-		bool pwm = false;
-		int code = 0;
-
-		int pos_goal = ((int)s.t[GOAL_POS_0_HIGH + i] << 16) | s.t[GOAL_POS_0_LOW + i];
-		int pos_err = 0;
-
-		// TODO: are left/right switched?
-		if (i == 1) pos_err = pos_goal - MOTOR_SCALE * (int)m_robot->rightTravelDistance();
-		else if (i == 3) pos_err = pos_goal - MOTOR_SCALE * (int)m_robot->leftTravelDistance();
-
-		int desired_speed = s.t[(GOAL_SPEED_0_HIGH + i)] << 16 | s.t[(GOAL_SPEED_0_LOW + i)];
-
-		switch(mode) {
-		case 0: // pwm
-			code = (s.t[MOTOR_DRIVE_CODE_T] >> ((3 - i) * 2)) & 0x3;
-			val = s.t[MOTOR_PWM_0 + i] / 2600.0;
-			if(code == 1) val = -val;
-			else if(code != 2) val = 0.0;
-			pwm = true;
-			if(val > 1.0) val = 1.0;
-			break;
-		case 1: // position
-			if ((pos_err > 0 && pos_err < GOAL_EPSILON)
-					|| (pos_err < 0 && pos_err > -GOAL_EPSILON)) {
-				val = 0.0;
-			} else {
-				val = pos_err / 2000.0;
-				if (val > 1.0) val = 1.0;
-        else if (val < -1.0) val = -1.0;
-			}
-			break;
-		case 2: // speed
-			val = (desired_speed) / 1000.0;
-			break;
-		case 3: // position at speed
-			if ((pos_err > 0 && pos_err < GOAL_EPSILON)
-					|| (pos_err < 0 && pos_err > -GOAL_EPSILON)
-					|| (pos_err < 0 && desired_speed > 0)
-					|| (pos_err > 0 && desired_speed < 0)){
-				val = 0.0;
-			} else {
-				val = (desired_speed) / 1000.0;
-			}
-			break;
-		}
-		
-    const static double m = 2.5;
-    int port = unfixPort(i);
-    foreach(const int p, _motors.keys(0)) if(port == p) m_robot->setLeftSpeed(val * (pwm ? m : 1.0));
-    foreach(const int p, _motors.keys(1)) if(port == p) m_robot->setRightSpeed(val * (pwm ? m : 1.0));
-
-    m_motors[port]->setValue(val * 100.0);
-    m_servos[i]->setValue((s.t[servos[port]] - 6500) * 2048 / 26000);
-	}
-	
-	static const int analogs[8] = {
-		AN_IN_0,
-		AN_IN_1,
-		AN_IN_2,
-		AN_IN_3,
-		AN_IN_4,
-		AN_IN_5,
-		AN_IN_6,
-		AN_IN_7
-	};
-  
-  const QList<int> leftRangeKeys    = _analogs->mapping().keys(0);
-  const QList<int> frontRangeKeys   = _analogs->mapping().keys(1);
-  const QList<int> rightRangeKeys   = _analogs->mapping().keys(2);
-  const QList<int> leftLightKeys    = _analogs->mapping().keys(3);
-  const QList<int> rightLightKeys   = _analogs->mapping().keys(4);
-  const QList<int> leftReflectKeys  = _analogs->mapping().keys(5);
-  const QList<int> rightReflectKeys = _analogs->mapping().keys(6);
-  
-  const QList<int> leftBumpKeys  = _digitals->mapping().keys(0);
-  const QList<int> rightBumpKeys = _digitals->mapping().keys(1);
-  
-  if(!leftRangeKeys.isEmpty()) {
-    const unsigned leftRange = m_robot->leftRange() / m_robot->rangeLength() * 1023.0;
-    foreach(const int port, leftRangeKeys) s.t[analogs[port]] = leftRange;
-  }
-  
-  if(!frontRangeKeys.isEmpty()) {
-    const unsigned frontRange = m_robot->frontRange() / m_robot->rangeLength() * 1023.0;
-    foreach(const int port, frontRangeKeys) s.t[analogs[port]] = frontRange;
-  }
-  
-  if(!rightRangeKeys.isEmpty()) {
-    const unsigned rightRange = m_robot->rightRange() / m_robot->rangeLength() * 1023.0;
-    foreach(const int port, rightRangeKeys) s.t[analogs[port]] = rightRange;
-  }
-  
-  if(!leftBumpKeys.isEmpty()) {
-    const unsigned leftRange = m_robot->leftRange() / m_robot->rangeLength() * 1023.0;
-    const bool leftBump = leftRange < 150;
-    foreach(const int port, leftBumpKeys) setDigital(port, leftBump);
-  }
-  
-  if(rightBumpKeys.isEmpty()) {
-    const unsigned rightRange = m_robot->rightRange() / m_robot->rangeLength() * 1023.0;
-    const bool rightBump = rightRange < 150;
-    foreach(const int port, rightBumpKeys) setDigital(port, rightBump);
-  }
-
-  const static double lightDisp = 15.0;
+  TRACE_SPAN("update");
   
-  if(!leftLightKeys.isEmpty()) {
-    const double lRad = M_PI * (m_robot->robot()[0]->rotation() + 45.0) / 180.0;
-    const QPointF leftLightPos = m_robot->robot()[0]->pos() + lightDisp * QPointF(cos(lRad), sin(lRad));
-    QLineF leftLightline(leftLightPos, m_light->pos());
-  	double leftLightValue = leftLightline.length() / 50.0 * 1023.0;
-  	if(leftLightValue > 1023.0) leftLightValue = 1023.0;
-    const unsigned leftLight = m_light->isOn() ? leftLightValue : 1023.0;
-  	foreach(const int port, _analogs->mapping().keys(3)) s.t[analogs[port]] = leftLight;
+  SimulationThread::Snapshot snapshot;
+  {
+    TRACE_SPAN("update.pose");
+    snapshot = _simulation->snapshot();
+    m_robot->syncGraphics(QPointF(snapshot.x, snapshot.y), snapshot.rotation);
   }
   
-  if(!rightLightKeys.isEmpty()) {
-    const double rRad = M_PI * (m_robot->robot()[0]->rotation() - 45.0) / 180.0;
-    const QPointF rightLightPos = m_robot->robot()[0]->pos() + lightDisp * QPointF(cos(rRad), sin(rRad));
-    QLineF rightLightline(rightLightPos, m_light->pos());
-    double rightLightValue = rightLightline.length() / 50.0 * 1023.0;
-    if(rightLightValue > 1023.0) rightLightValue = 1023.0;
-    const unsigned rightLight = m_light->isOn() ? rightLightValue : 1023.0;
-    foreach(const int port, _analogs->mapping().keys(4)) s.t[analogs[port]] = rightLight;
-  }
-  
-  if(!leftReflectKeys.isEmpty()) {
-    const unsigned leftReflect = m_robot->leftReflectance() * 1023.0;;
-    foreach(const int port, _analogs->mapping().keys(5)) s.t[analogs[port]] = leftReflect;
-  }
-  
-  if(!rightReflectKeys.isEmpty()) {
-    const unsigned rightReflect = m_robot->rightReflectance() * 1023.0;;
-	  foreach(const int port, _analogs->mapping().keys(6)) s.t[analogs[port]] = rightReflect;
-  }
-  
-	for(unsigned i = 0; i < 8; ++i) {
-    _analogs->setValue(i, s.t[analogs[i]]);
-    _digitals->setValue(i, s.t[DIG_IN] & (1 << (7 - i)) ? 0 : 1);
+  if(!m_process) return;
+	
+	RegisterReadout registers;
+	{
+		TRACE_SPAN("update.registers");
+		QMutexLocker locker(m_kmod->mutex());
+		registers.read(m_kmod->state());
 	}
 
+	TRACE_SPAN("update.widgets");
+	for(int i = 0; i < 4; ++i) m_motors[unfixPort(i)]->setValue(snapshot.motorOutputs[i] * 100.0);
+	
+  _analogs->setValues(registers.analogs, 8);
+  _digitals->setValues(registers.digitals, 8);
+
 	ui->scrollArea->update();
-  ui->sim->update();
 }
 
 
@@ -443,7 +365,6 @@ void MainWindow::run(const QString &executable)
 {
 	raise();
 	stop();
-  m_robot->restartTime();
 	// reset();
 	m_process = new QProcess();
 	connect(m_process, SIGNAL(finished(int, QProcess::ExitStatus)),
@@ -474,6 +395,7 @@ void MainWindow::run(const QString &executable)
 	m_process->start(root.bin(executable).filePath(executable), QStringList());
 	if(!m_process->waitForStarted(10000)) stop();
 	ui->actionStop->setEnabled(true);
+	syncServos();
 	ui->console->setProcess(m_process);
 }
 
@@ -511,6 +433,26 @@ void MainWindow::updateAdvert()
 	m_heartbeat->setAdvert(ad);
 }
 
+void MainWindow::registerChanged(Event event, unsigned short address, unsigned short value)
+{
+	if(event == ServoCommand) setServo(address - SERVO_COMMAND_0, value);
+}
+
+void MainWindow::setServo(const int channel, const unsigned short command)
+{
+	m_servos[unfixPort(channel)]->setValue((command - 6500) * 2048 / 26000);
+}
+
+void MainWindow::syncServos()
+{
+	unsigned short commands[4];
+	QMutexLocker locker(m_kmod->mutex());
+	for(int i = 0; i < 4; ++i) commands[i] = m_kmod->state().t[SERVO_COMMAND_0 + i];
+	locker.unlock();
+	
+	for(int i = 0; i < 4; ++i) setServo(i, commands[i]);
+}
+
 int MainWindow::unfixPort(int port)
 {
 	switch(port) {
@@ -522,23 +464,127 @@ int MainWindow::unfixPort(int port)
 	return port;
 }
 
+void MainWindow::setMotorMapping(const QMap<int, int> &mapping)
+{
+  int wheelChannels[2] = { -1, -1 };
+  QMap<int, int>::const_iterator it = mapping.constBegin();
+  for(; it != mapping.constEnd(); ++it) {
+    if(it.value() < 0 || it.value() > 1 || it.key() < 0 || it.key() > 3) continue;
+    wheelChannels[it.value()] = unfixPort(it.key());
+  }
+  _simulation->setWheelChannels(wheelChannels[0], wheelChannels[1]);
+}
+
 void MainWindow::reset()
 {
+	restoreWorld(_start);
 	m_buttonProvider->reset();
-	m_robot->setLeftSpeed(0.0);
-	m_robot->setRightSpeed(0.0);
-	m_robot->setLeftTravelDistance(0.0);
-	m_robot->setRightTravelDistance(0.0);
-	m_robot->reset();
-	m_light->reset();
-	m_robot->robot()[0]->setRotation(45);
 }
 
-void MainWindow::setDigital(int port, bool on)
+void MainWindow::saveCheckpoint()
+{
+	_checkpoint = saveWorld();
+	ui->actionRestoreCheckpoint->setEnabled(true);
+}
+
+void MainWindow::restoreCheckpoint()
+{
+	restoreWorld(_checkpoint);
+}
+
+void MainWindow::recordTraffic(bool record)
+{
+	if(!record) {
+		m_kmod->setTrafficLog(0);
+		m_trafficLog->close();
+		return;
+	}
+	
+	const QString path = QFileDialog::getSaveFileName(this, tr("Record Register Traffic"),
+		QDir(m_server->userRoot()).filePath("traffic.kstraffic"), tr("Traffic Logs (*.kstraffic)"));
+	if(path.isEmpty() || !m_trafficLog->open(path)) {
+		ui->actionRecordTraffic->setChecked(false);
+		return;
+	}
+	
+	m_kmod->setTrafficLog(m_trafficLog);
+}
+
+void MainWindow::recordTelemetry(bool record)
+{
+	if(!record) {
+		_simulation->setTelemetry(0);
+		if(_telemetry->dropped()) qWarning() << "Telemetry dropped" << _telemetry->dropped() << "samples";
+		_telemetry->close();
+		return;
+	}
+	
+	const QString path = QFileDialog::getSaveFileName(this, tr("Record Telemetry"),
+		QDir(m_server->userRoot()).filePath("telemetry.kstelemetry"), tr("Telemetry (*.kstelemetry)"));
+	if(path.isEmpty() || !_telemetry->open(path)) {
+		ui->actionRecordTelemetry->setChecked(false);
+		return;
+	}
+	
+	_simulation->setTelemetry(_telemetry);
+}
+
+void MainWindow::trace(bool enabled)
+{
+	if(enabled) Trace::clear();
+	Trace::setEnabled(enabled);
+}
+
+void MainWindow::saveTrace()
+{
+	const QString path = QFileDialog::getSaveFileName(this, tr("Save Trace"),
+		QDir(m_server->userRoot()).filePath("trace.json"), tr("Chrome Traces (*.json)"));
+	if(path.isEmpty()) return;
+	Trace::dump(path);
+}
+
+WorldSnapshot MainWindow::saveWorld() const
 {
-	Kovan::State &s = m_kmod->state();
-	if(!on) s.t[DIG_IN] |= 1 << (7 - port);
-	else s.t[DIG_IN] &= ~(1 << (7 - port));
+	WorldSnapshot snapshot;
+	QMutexLocker locker(m_kmod->mutex());
+	m_kmod->save(snapshot.state, snapshot.motors);
+	snapshot.robot = m_robot->kinematics();
+	_simulation->clock(snapshot.tick, snapshot.time);
+	locker.unlock();
+	
+	snapshot.lightX = m_light->x();
+	snapshot.lightY = m_light->y();
+	snapshot.lightOn = m_light->isOn();
+	snapshot.setBoard(currentBoardName());
+	return snapshot;
+}
+
+void MainWindow::restoreWorld(const WorldSnapshot &snapshot)
+{
+	const QString board = snapshot.board();
+	if(board != currentBoardName() && _boardFileManager.lookupEntry(board)) {
+		_pendingWorld = snapshot;
+		_worldPending = true;
+		
+		QSettings settings;
+		settings.beginGroup("board");
+		settings.setValue("current_board", board);
+		settings.endGroup();
+		updateBoard();
+		return;
+	}
+	
+	QMutexLocker locker(m_kmod->mutex());
+	m_kmod->restore(snapshot.state, snapshot.motors);
+	m_robot->setKinematics(snapshot.robot);
+	_simulation->setClock(snapshot.tick, snapshot.time);
+	_sensors->invalidate();
+	locker.unlock();
+	syncServos();
+	m_buttonProvider->refreshAll();
+	
+	m_light->setPos(snapshot.lightX, snapshot.lightY);
+	m_light->setOn(snapshot.lightOn);
 }
 
 void MainWindow::updatePorts()
@@ -558,32 +604,78 @@ void MainWindow::configPorts()
   if(config.exec() == QDialog::Rejected) return;
   _analogs->setMapping(config.analogMapping(), _analogs->roles());
   _digitals->setMapping(config.digitalMapping(), _digitals->roles(), 8);
-  _motors = config.motorMapping();
+  setMotorMapping(config.motorMapping());
+  _sensors->setAnalogMapping(_analogs->mapping());
+  _sensors->setDigitalMapping(_digitals->mapping());
 }
 
 void MainWindow::updateBoard()
 {
-  QSettings settings;
-  settings.beginGroup("board");
-  BoardFile *const boardFile = _boardFileManager.lookupBoardFile(settings.value("current_board", "2013").toString());
-  settings.endGroup();
-  ui->sim->setScene(boardFile->scene());
-  putRobotAndLight();
+  // Set first, as a cached board is delivered before this returns
+  _requestedBoard = currentBoardName();
+  if(!_boardFileManager.requestBoardFile(_requestedBoard)) _requestedBoard.clear();
+}
+
+void MainWindow::boardLoaded(BoardFile *board)
+{
+  // The selector's preview also requests boards; only apply the ones asked
+  // for here
+  if(_requestedBoard.isEmpty() || board->name() != _requestedBoard) return;
+  _requestedBoard.clear();
+  
+  if(board != _board) {
+    _boardFileManager.retain(board);
+    ui->sim->setBoardScene(board->scene());
+    
+    Walls *const walls = new Walls(board);
+    QMutexLocker locker(m_kmod->mutex());
+    m_robot->setWalls(walls);
+    if(!_worldPending) m_robot->setRotation(_start.robot.rotation);
+    locker.unlock();
+    
+    delete _walls;
+    _walls = walls;
+    if(_board) _boardFileManager.release(_board);
+    _board = board;
+    
+    // Reset now returns to the start pose on this board
+    _start.setBoard(board->name());
+  }
+  
+  if(_worldPending) {
+    _worldPending = false;
+    restoreWorld(_pendingWorld);
+  }
+}
+
+void MainWindow::boardChanged(BoardFile *board)
+{
+  if(board != _board) return;
+  // The scene was patched in place, so only the collision geometry and
+  // cached readings are out of date. The robot's pose and any running
+  // program are left alone.
+  Walls *const walls = new Walls(board);
+  QMutexLocker locker(m_kmod->mutex());
+  m_robot->setWalls(walls);
+  _sensors->invalidate();
+  locker.unlock();
+  
+  delete _walls;
+  _walls = walls;
 }
 
 void MainWindow::selectBoard()
 {
   _boardFileManager.reload();
   
-  BoardSelectorDialog boardSelector(this);
-  boardSelector.setBoardFiles(_boardFileManager.boardFiles());
+  BoardSelectorDialog boardSelector(&_boardFileManager, this);
   if(boardSelector.exec() != QDialog::Accepted) return;
-  BoardFile *const board = boardSelector.selectedBoardFile();
-  if(!board) return;
+  const QString board = boardSelector.selectedBoardName();
+  if(board.isEmpty()) return;
     
   QSettings settings;
   settings.beginGroup("board");
-  settings.setValue("current_board", board->name());
+  settings.setValue("current_board", board);
   settings.endGroup();
   settings.sync();
   updateBoard();
@@ -601,14 +693,24 @@ void MainWindow::newBoard(const QString &board)
   updateBoard();
 }
 
+QString MainWindow::currentBoardName() const
+{
+  QSettings settings;
+  settings.beginGroup("board");
+  const QString name = settings.value("current_board", "2013").toString();
+  settings.endGroup();
+  return name;
+}
+
 bool MainWindow::putRobotAndLight()
 {
-	if(!ui->sim->scene()) return false;
+	if(!_scene) return false;
   
-  foreach(QGraphicsItem *item, m_robot->robot())
-    ui->sim->scene()->addItem(item);
-  ui->sim->scene()->addItem(m_light);
-  m_robot->robot()[0]->setRotation(45);
+  foreach(QGraphicsItem *item, m_robot->robot()) {
+    if(item->scene() != _scene) _scene->addItem(item);
+  }
+  if(m_light->scene() != _scene) _scene->addItem(m_light);
+  m_robot->setRotation(45);
   
   return true;
 }
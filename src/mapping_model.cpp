@@ -1,119 +1,9 @@
 #include "mapping_model.hpp"
 
-class PortItem : public QStandardItem
-{
-public:
-  PortItem(const int port, const int offset)
-    : _port(port)
-    , _offset(offset)
-  {
-    setText(QString::number(_port + _offset));
-  }
-  
-  void setPort(const int port)
-  {
-    _port = port;
-    setText(QString::number(_port + _offset));
-  }
-  
-  int port() const
-  {
-    return _port;
-  }
-  
-  template<typename T>
-  static PortItem *portitem_cast(T *const t)
-  {
-    return dynamic_cast<PortItem *>(t);
-  }
-  
-  template<typename T>
-  static const PortItem *portitem_cast(const T *const t)
-  {
-    return dynamic_cast<const PortItem *>(t);
-  }
-  
-private:
-  int _port;
-  int _offset;
-};
-
-class ValueItem : public QStandardItem
-{
-public:
-  ValueItem()
-  {
-  }
-  
-  void setValue(const int value)
-  {
-    _value = value;
-    setText(QString::number(_value));
-  }
-  
-  int value() const
-  {
-    return _value;
-  }
-  
-  template<typename T>
-  static ValueItem *valueitem_cast(T *const t)
-  {
-    return dynamic_cast<ValueItem *>(t);
-  }
-  
-  template<typename T>
-  static const ValueItem *valueitem_cast(const T *const t)
-  {
-    return dynamic_cast<const ValueItem *>(t);
-  }
-  
-private:
-  int _value;
-};
-
-class RoleItem : public QStandardItem
-{
-public:
-  RoleItem(const QString &role)
-    : _role(role)
-  {
-    setText(_role);
-  }
-  
-  void setRole(const QString &role)
-  {
-    _role = role;
-    setText(_role);
-  }
-  
-  const QString &role() const
-  {
-    return _role;
-  }
-  
-  template<typename T>
-  static RoleItem *roleitem_cast(T *const t)
-  {
-    return dynamic_cast<RoleItem *>(t);
-  }
-  
-  template<typename T>
-  static const RoleItem *roleitem_cast(const T *const t)
-  {
-    return dynamic_cast<const RoleItem *>(t);
-  }
-  
-private:
-  QString _role;
-};
-
 MappingModel::MappingModel(QObject *const parent)
-  : QStandardItemModel(parent)
+  : QAbstractTableModel(parent)
+  , _offset(0)
 {
-  setHorizontalHeaderItem(0, new QStandardItem(tr("Port")));
-  setHorizontalHeaderItem(1, new QStandardItem(tr("Value")));
-  setHorizontalHeaderItem(2, new QStandardItem(tr("Role")));
 }
 
 MappingModel::~MappingModel()
@@ -122,28 +12,43 @@ MappingModel::~MappingModel()
 
 void MappingModel::setValue(const int port, const int value)
 {
-  for(int i = 0; i < rowCount(); ++i) {
-    PortItem *const p = PortItem::portitem_cast(item(i, 0));
-    if(!p || p->port() != port) continue;
-    ValueItem *const val = ValueItem::valueitem_cast(item(i, 1));
-    if(!val) continue;
-    val->setValue(value);
+  const int row = _ports.indexOf(port);
+  if(row < 0 || _values[row] == value) return;
+  _values[row] = value;
+  const QModelIndex i = index(row, 1);
+  emit dataChanged(i, i);
+}
+
+void MappingModel::setValues(const int *const values, const int count)
+{
+  int first = -1;
+  int last = -1;
+  
+  const int rows = _ports.size();
+  int *const current = _values.data();
+  for(int row = 0; row < rows; ++row) {
+    const int port = _ports[row];
+    if(port < 0 || port >= count || current[row] == values[port]) continue;
+    current[row] = values[port];
+    if(first < 0) first = row;
+    last = row;
   }
+  
+  if(first < 0) return;
+  emit dataChanged(index(first, 1), index(last, 1));
 }
 
 void MappingModel::setMapping(const QMap<int, int> &map, const QStringList &roles, const int offset)
 {
-  while(rowCount()) qDeleteAll(takeRow(0));
-
+  beginResetModel();
   _map = map;
   _roles = roles;
   _offset = offset;
-  foreach(const int key, _map.keys()) {
-    RoleItem *const role = new RoleItem(roles[_map[key]]);
-    PortItem *const port = new PortItem(key, _offset);
-    ValueItem *const value = new ValueItem();
-    appendRow(QList<QStandardItem *>() << port << value << role);
-  }
+  
+  _ports = _map.keys().toVector();
+  _portRoles = _map.values().toVector();
+  _values.fill(0, _ports.size());
+  endResetModel();
 }
 
 const QMap<int, int> &MappingModel::mapping() const
@@ -154,4 +59,44 @@ const QMap<int, int> &MappingModel::mapping() const
 const QStringList &MappingModel::roles() const
 {
   return _roles;
-}
\ No newline at end of file
+}
+
+int MappingModel::rowCount(const QModelIndex &parent) const
+{
+  return parent.isValid() ? 0 : _ports.size();
+}
+
+int MappingModel::columnCount(const QModelIndex &parent) const
+{
+  return parent.isValid() ? 0 : 3;
+}
+
+QVariant MappingModel::data(const QModelIndex &index, int role) const
+{
+  if(role != Qt::DisplayRole || !index.isValid()) return QVariant();
+  
+  const int row = index.row();
+  if(row < 0 || row >= _ports.size()) return QVariant();
+  
+  switch(index.column()) {
+  case 0: return QString::number(_ports[row] + _offset);
+  case 1: return QString::number(_values[row]);
+  case 2: return _roles.value(_portRoles[row]);
+  default: break;
+  }
+  return QVariant();
+}
+
+QVariant MappingModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+  if(role != Qt::DisplayRole) return QVariant();
+  if(orientation != Qt::Horizontal) return QAbstractTableModel::headerData(section, orientation, role);
+  
+  switch(section) {
+  case 0: return tr("Port");
+  case 1: return tr("Value");
+  case 2: return tr("Role");
+  default: break;
+  }
+  return QVariant();
+}
@@ -0,0 +1,176 @@
+#include "metrics.hpp"
+
+#include <QtAlgorithms>
+#include <cstring>
+
+#define NANOSECONDS 1e-9
+
+Metrics::Counter *Metrics::_counters = 0;
+Metrics::Counter **Metrics::_counterTail = &Metrics::_counters;
+Metrics::Histogram *Metrics::_histograms = 0;
+Metrics::Histogram **Metrics::_histogramTail = &Metrics::_histograms;
+
+// Exported in the order defined here; counters sharing a name must be adjacent
+Metrics::Counter Metrics::kmodPackets("ks2_kmod_packets_total", 0,
+  "Datagrams handled by the register engine");
+Metrics::Histogram Metrics::kmodResponseLatency("ks2_kmod_response_latency_seconds",
+  "Time from receiving a state request to sending the state back", NANOSECONDS);
+
+Metrics::Counter Metrics::ticks("ks2_sim_ticks_total", 0,
+  "Simulation ticks run");
+Metrics::Counter Metrics::tickOverruns("ks2_sim_tick_overruns_total", 0,
+  "Ticks that were due while a previous tick was still running");
+Metrics::Histogram Metrics::tickDuration("ks2_sim_tick_duration_seconds",
+  "Time spent simulating one tick", NANOSECONDS);
+
+Metrics::Counter Metrics::consoleStdoutBytes("ks2_console_bytes_total", "stream=\"stdout\"",
+  "Bytes of program output shown in the console");
+Metrics::Counter Metrics::consoleStderrBytes("ks2_console_bytes_total", "stream=\"stderr\"",
+  "Bytes of program output shown in the console");
+
+Metrics::Histogram Metrics::uploadSize("ks2_upload_size_bytes",
+  "Size of uploaded program archives", 1.0);
+Metrics::Histogram Metrics::uploadDuration("ks2_upload_duration_seconds",
+  "Time taken to receive a program archive", NANOSECONDS);
+Metrics::Histogram Metrics::compileDuration("ks2_compile_duration_seconds",
+  "Time taken to compile and install a program", NANOSECONDS);
+
+Metrics::Counter Metrics::boardCacheHits("ks2_cache_lookups_total", "cache=\"board\",result=\"hit\"",
+  "Cache lookups by cache and result");
+Metrics::Counter Metrics::boardCacheMisses("ks2_cache_lookups_total", "cache=\"board\",result=\"miss\"",
+  "Cache lookups by cache and result");
+Metrics::Counter Metrics::compiledBoardHits("ks2_cache_lookups_total", "cache=\"compiled_board\",result=\"hit\"",
+  "Cache lookups by cache and result");
+Metrics::Counter Metrics::compiledBoardMisses("ks2_cache_lookups_total", "cache=\"compiled_board\",result=\"miss\"",
+  "Cache lookups by cache and result");
+Metrics::Counter Metrics::thumbnailCacheHits("ks2_cache_lookups_total", "cache=\"thumbnail\",result=\"hit\"",
+  "Cache lookups by cache and result");
+Metrics::Counter Metrics::thumbnailCacheMisses("ks2_cache_lookups_total", "cache=\"thumbnail\",result=\"miss\"",
+  "Cache lookups by cache and result");
+
+Metrics::Counter::Counter(const char *const name, const char *const labels, const char *const help)
+  : _name(name)
+  , _labels(labels)
+  , _help(help)
+  , _value(0)
+  , _next(0)
+{
+  *Metrics::_counterTail = this;
+  Metrics::_counterTail = &_next;
+}
+
+quint64 Metrics::Counter::value() const
+{
+  return _value.load();
+}
+
+Metrics::Histogram::Histogram(const char *const name, const char *const help, const double unit)
+  : _name(name)
+  , _help(help)
+  , _unit(unit)
+  , _count(0)
+  , _sum(0)
+  , _next(0)
+{
+  for(int i = 0; i < BucketCount; ++i) _buckets[i].store(0);
+  *Metrics::_histogramTail = this;
+  Metrics::_histogramTail = &_next;
+}
+
+quint64 Metrics::Histogram::count() const
+{
+  return _count.load();
+}
+
+int Metrics::Histogram::bucket(const quint64 value)
+{
+  if(value < SubBuckets) return value;
+  const int exponent = 63 - qCountLeadingZeroBits(value);
+  const int shift = exponent - SubBucketBits;
+  return SubBuckets + shift * SubBuckets + ((value >> shift) & (SubBuckets - 1));
+}
+
+quint64 Metrics::Histogram::upperBound(const int bucket)
+{
+  if(bucket < SubBuckets) return bucket;
+  const int shift = (bucket - SubBuckets) / SubBuckets;
+  const quint64 mantissa = SubBuckets + (bucket - SubBuckets) % SubBuckets;
+  // Wraps to the largest quint64 for the very last bucket
+  return ((mantissa + 1) << shift) - 1;
+}
+
+static void header(QByteArray &out, const char *const name, const char *const help, const char *const type)
+{
+  out += "# HELP ";
+  out += name;
+  out += " ";
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += " ";
+  out += type;
+  out += "\n";
+}
+
+static QByteArray number(const double value)
+{
+  return QByteArray::number(value, 'g', 10);
+}
+
+QByteArray Metrics::exposition()
+{
+  QByteArray out;
+  out.reserve(16384);
+  
+  const char *previous = 0;
+  for(const Counter *c = _counters; c; c = c->_next) {
+    if(!previous || strcmp(previous, c->_name)) header(out, c->_name, c->_help, "counter");
+    previous = c->_name;
+  
+    out += c->_name;
+    if(c->_labels) {
+      out += "{";
+      out += c->_labels;
+      out += "}";
+    }
+    out += " ";
+    out += QByteArray::number(c->value());
+    out += "\n";
+  }
+  
+  for(const Histogram *h = _histograms; h; h = h->_next) {
+    header(out, h->_name, h->_help, "histogram");
+  
+    // Buckets are read one by one while others may still be recording, so
+    // the total is taken from the buckets themselves to stay consistent.
+    // Empty buckets add nothing to a cumulative histogram and are skipped.
+    quint64 cumulative = 0;
+    for(int i = 0; i < Histogram::BucketCount - 1; ++i) {
+      const quint64 n = h->_buckets[i].load();
+      if(!n) continue;
+      cumulative += n;
+      out += h->_name;
+      out += "_bucket{le=\"";
+      out += number(Histogram::upperBound(i) * h->_unit);
+      out += "\"} ";
+      out += QByteArray::number(cumulative);
+      out += "\n";
+    }
+    cumulative += h->_buckets[Histogram::BucketCount - 1].load();
+  
+    out += h->_name;
+    out += "_bucket{le=\"+Inf\"} ";
+    out += QByteArray::number(cumulative);
+    out += "\n";
+    out += h->_name;
+    out += "_sum ";
+    out += number(h->_sum.load() * h->_unit);
+    out += "\n";
+    out += h->_name;
+    out += "_count ";
+    out += QByteArray::number(cumulative);
+    out += "\n";
+  }
+  
+  return out;
+}
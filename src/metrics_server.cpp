@@ -0,0 +1,62 @@
+#include "metrics_server.hpp"
+#include "metrics.hpp"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QDebug>
+
+MetricsServer::MetricsServer(QObject *parent)
+	: QObject(parent),
+	m_server(new QLocalServer(this))
+{
+	connect(m_server, SIGNAL(newConnection()), SLOT(newConnection()));
+}
+
+MetricsServer::~MetricsServer()
+{
+}
+
+bool MetricsServer::listen(const QString &name)
+{
+	if(!m_server->listen(name) && m_server->serverError() == QAbstractSocket::AddressInUseError) {
+		// Only a socket file left behind by a crashed instance is cleared;
+		// one that still answers belongs to another running instance
+		QLocalSocket probe;
+		probe.connectToServer(name);
+		if(probe.waitForConnected(100)) {
+			qWarning() << "Another instance is already serving metrics on" << name;
+			return false;
+		}
+		QLocalServer::removeServer(name);
+		m_server->listen(name);
+	}
+	if(!m_server->isListening()) {
+		qWarning() << "Failed to serve metrics on" << name << m_server->errorString();
+		return false;
+	}
+	return true;
+}
+
+QString MetricsServer::fullServerName() const
+{
+	return m_server->fullServerName();
+}
+
+void MetricsServer::newConnection()
+{
+	while(QLocalSocket *socket = m_server->nextPendingConnection()) {
+		const QByteArray body = Metrics::exposition();
+		
+		// The request is never read; every path gets the metrics
+		QByteArray response = "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: ";
+		response += QByteArray::number(body.size());
+		response += "\r\n\r\n";
+		response += body;
+		
+		connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+		socket->write(response);
+		socket->disconnectFromServer();
+	}
+}
@@ -0,0 +1,89 @@
+#define _USE_MATH_DEFINES
+
+#include "rangefinder.hpp"
+#include "walls.hpp"
+
+#include <cmath>
+
+Rangefinder::Rangefinder()
+  : _beams(0)
+  , _fieldOfView(360.0)
+  , _range(150.0)
+{
+}
+
+void Rangefinder::setBeams(const quint32 beams)
+{
+  _beams = beams;
+  updateBeams();
+}
+
+quint32 Rangefinder::beams() const
+{
+  return _beams;
+}
+
+void Rangefinder::setFieldOfView(const double fieldOfView)
+{
+  _fieldOfView = qBound(0.0, fieldOfView, 360.0);
+  updateBeams();
+}
+
+double Rangefinder::fieldOfView() const
+{
+  return _fieldOfView;
+}
+
+void Rangefinder::setRange(const double range)
+{
+  _range = range;
+  _readings.fill(_range, _beams);
+}
+
+double Rangefinder::range() const
+{
+  return _range;
+}
+
+void Rangefinder::scan(const Walls *const walls, const QPointF &origin, const double heading)
+{
+  if(!_beams) return;
+  if(!walls) {
+    _readings.fill(_range, _beams);
+    return;
+  }
+  
+  const double rad = heading / 180.0 * M_PI;
+  const double c = std::cos(rad);
+  const double s = std::sin(rad);
+  for(quint32 i = 0; i < _beams; ++i) {
+    _dx[i] = _cos[i] * c - _sin[i] * s;
+    _dy[i] = _sin[i] * c + _cos[i] * s;
+  }
+  walls->cast(origin, _dx.constData(), _dy.constData(), _beams, _range, _readings.data());
+}
+
+const QVector<double> &Rangefinder::readings() const
+{
+  return _readings;
+}
+
+void Rangefinder::updateBeams()
+{
+  _cos.resize(_beams);
+  _sin.resize(_beams);
+  _dx.resize(_beams);
+  _dy.resize(_beams);
+  _readings.fill(_range, _beams);
+  if(!_beams) return;
+  
+  const bool fullTurn = _fieldOfView >= 360.0;
+  const double span = _fieldOfView / 180.0 * M_PI;
+  const double step = _beams > 1 ? span / (fullTurn ? _beams : _beams - 1) : 0.0;
+  const double first = _beams > 1 ? -span / 2.0 : 0.0;
+  for(quint32 i = 0; i < _beams; ++i) {
+    const double a = first + i * step;
+    _cos[i] = std::cos(a);
+    _sin[i] = std::sin(a);
+  }
+}
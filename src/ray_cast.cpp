@@ -0,0 +1,64 @@
+#include "ray_cast.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// For a ray o + t * d and a segment a + u * e, with w = a - o:
+//   t = cross(w, e) / cross(d, e), u = cross(w, d) / cross(d, e)
+// A hit needs t >= 0 and 0 <= u <= 1. Parallel segments divide by zero and
+// produce infinities or NaNs, which fail those comparisons.
+
+static inline double castRay(const RayCastSegments &segments, const double ox, const double oy,
+  const double dx, const double dy, const double maxRange)
+{
+  double best = maxRange;
+  for(quint32 j = 0; j < segments.count; ++j) {
+    const double wx = segments.x[j] - ox;
+    const double wy = segments.y[j] - oy;
+    const double ex = segments.ex[j];
+    const double ey = segments.ey[j];
+    const double denom = dx * ey - dy * ex;
+    if(denom == 0.0) continue;
+    const double t = (wx * ey - wy * ex) / denom;
+    const double u = (wx * dy - wy * dx) / denom;
+    if(t >= 0.0 && u >= 0.0 && u <= 1.0 && t < best) best = t;
+  }
+  return best;
+}
+
+void castRays(const RayCastSegments &segments, const double ox, const double oy,
+  const double *const dx, const double *const dy, const quint32 rays,
+  const double maxRange, double *const ranges)
+{
+  quint32 i = 0;
+  
+#ifdef __SSE2__
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d one = _mm_set1_pd(1.0);
+  for(; i + 2 <= rays; i += 2) {
+    const __m128d rdx = _mm_loadu_pd(dx + i);
+    const __m128d rdy = _mm_loadu_pd(dy + i);
+    __m128d best = _mm_set1_pd(maxRange);
+    for(quint32 j = 0; j < segments.count; ++j) {
+      const __m128d wx = _mm_set1_pd(segments.x[j] - ox);
+      const __m128d wy = _mm_set1_pd(segments.y[j] - oy);
+      const __m128d ex = _mm_set1_pd(segments.ex[j]);
+      const __m128d ey = _mm_set1_pd(segments.ey[j]);
+      
+      const __m128d denom = _mm_sub_pd(_mm_mul_pd(rdx, ey), _mm_mul_pd(rdy, ex));
+      const __m128d t = _mm_div_pd(_mm_sub_pd(_mm_mul_pd(wx, ey), _mm_mul_pd(wy, ex)), denom);
+      const __m128d u = _mm_div_pd(_mm_sub_pd(_mm_mul_pd(wx, rdy), _mm_mul_pd(wy, rdx)), denom);
+      
+      const __m128d hit = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(t, zero), _mm_cmpge_pd(u, zero)),
+        _mm_cmple_pd(u, one));
+      // Lanes that miss keep their current best
+      const __m128d candidate = _mm_or_pd(_mm_and_pd(hit, t), _mm_andnot_pd(hit, best));
+      best = _mm_min_pd(best, candidate);
+    }
+    _mm_storeu_pd(ranges + i, best);
+  }
+#endif
+  
+  for(; i < rays; ++i) ranges[i] = castRay(segments, ox, oy, dx[i], dy[i], maxRange);
+}
@@ -0,0 +1,22 @@
+#include "register_readout.hpp"
+#include "kovan_regs_p.hpp"
+
+static const int analogRegisters[8] = {
+  AN_IN_0,
+  AN_IN_1,
+  AN_IN_2,
+  AN_IN_3,
+  AN_IN_4,
+  AN_IN_5,
+  AN_IN_6,
+  AN_IN_7
+};
+
+void RegisterReadout::read(const Kovan::State &state)
+{
+  const unsigned short digitalIn = state.t[DIG_IN];
+  for(unsigned i = 0; i < 8; ++i) {
+    analogs[i] = state.t[analogRegisters[i]];
+    digitals[i] = digitalIn & (1 << (7 - i)) ? 0 : 1;
+  }
+}
@@ -8,6 +8,8 @@
 #include <QPen>
 #include <QDebug>
 #include "board_file.hpp"
+#include "walls.hpp"
+#include "rangefinder.hpp"
 
 #include <cmath>
 #include <QGraphicsSceneMouseEvent>
@@ -15,18 +17,39 @@
 
 #include "kovan_spiral-inl.hpp"
 
-//TODO: load these
 static const double robotRad = 10.0;
-static const double boardMaxX = 243.205 - robotRad;
-static const double boardMaxY = 243.205 - robotRad;
-static const double boardMinX = 0.0 + robotRad;
-static const double boardMinY = 0.0 + robotRad;
+
+// Distance kept from a wall after a collision, and how many times the
+// remaining motion may slide along walls in one step
+static const double collisionSkin = 0.0001;
+static const int maxSlides = 3;
+
+// Largest turn (radians) and distance (cm) covered by one collision sub-step
+static const double maxStepTurn = M_PI / 36.0;
+static const double maxStepDistance = 1.0;
+
+// Walls this close count as touching. Each bumper covers one side of the
+// front, overlapping a little at the center.
+static const double contactSlop = 0.5;
+static const double bumpArc = 0.75 * M_PI;
+static const double bumpOverlap = M_PI / 12.0;
+
+enum SensorStale
+{
+	RangeStale = 1 << 0,
+	LeftReflectanceStale = 1 << 1,
+	RightReflectanceStale = 1 << 2,
+	BumpStale = 1 << 3,
+	ScanStale = 1 << 4,
+	AllSensorsStale = 0x1F
+};
 
 class RobotBase : public QGraphicsRectItem
 {
 public:
-	RobotBase(double x, double y, double w, double h)
+	RobotBase(Robot *owner, double x, double y, double w, double h)
 		: QGraphicsRectItem(x, y, w, h),
+		m_owner(owner),
 		m_grabbed(false),
 		m_turnEvent(false)
 	{
@@ -45,9 +68,11 @@ protected:
 		if(!m_grabbed) return;
 		if(!m_turnEvent) {
 			setPos(event->scenePos());
+			m_owner->setPosition(pos());
 		} else {
 			QLineF line(pos(), event->scenePos());
 			setRotation(360 - line.angle());
+			m_owner->setRotation(rotation());
 		}
 	}
 	
@@ -71,6 +96,7 @@ protected:
 	}
 	
 private:
+	Robot *m_owner;
 	bool m_grabbed;
 	bool m_turnEvent;
 };
@@ -81,9 +107,19 @@ Robot::Robot()
 	m_leftSpeed(0.0),
 	m_rightSpeed(0.0),
 	m_rangeLength(70.0),
+	m_leftReflectance(0.0),
+	m_rightReflectance(0.0),
+	m_leftBump(false),
+	m_rightBump(false),
+	m_stale(AllSensorsStale),
 	m_leftTravelDistance(0.0),
 	m_rightTravelDistance(0.0),
-	m_robot(new RobotBase(-m_wheelDiameter / 2.0, -m_wheelDiameter / 2.0, m_wheelDiameter, m_wheelDiameter)),
+	m_x(0.0),
+	m_y(0.0),
+	m_rotation(0.0),
+	m_walls(0),
+	m_collisionRadius(robotRad),
+	m_robot(new RobotBase(this, -m_wheelDiameter / 2.0, -m_wheelDiameter / 2.0, m_wheelDiameter, m_wheelDiameter)),
 	m_leftWheel(new QGraphicsEllipseItem(-m_wheelRadii, -m_wheelDiameter / 2.0 - m_wheelRadii, m_wheelRadii * 2, m_wheelRadii)),
 	m_rightWheel(new QGraphicsEllipseItem(-m_wheelRadii, m_wheelDiameter / 2.0, m_wheelRadii * 2, m_wheelRadii)),
 	m_leftRange(new QGraphicsLineItem()),
@@ -103,8 +139,6 @@ Robot::Robot()
 	m_leftWheel->setBrush(Qt::darkGray);
 	m_rightWheel->setBrush(Qt::darkGray);
 	
-	updateRangeLines();
-	
 	QPen rangePen(Qt::red, 0, Qt::DotLine);
 	m_leftRange->setPen(rangePen);
 	m_frontRange->setPen(rangePen);
@@ -113,16 +147,38 @@ Robot::Robot()
 	m_leftRange->setZValue(-0.1);
 	m_frontRange->setZValue(-0.1);
 	m_rightRange->setZValue(-0.1);
+	
+	for(int i = 0; i < 3; ++i) m_ranges[i] = 0.0;
 
 	this->reset();
-
-	m_time.start();
+	syncGraphics(position(), rotation());
 }
 
 void Robot::reset()
 {
-	m_robot->setX(15.0);
-	m_robot->setY(15.0);
+	setPosition(QPointF(15.0, 15.0));
+}
+
+void Robot::setWalls(const Walls *walls)
+{
+	m_walls = walls;
+	invalidateSensors();
+}
+
+const Walls *Robot::walls() const
+{
+	return m_walls;
+}
+
+void Robot::setCollisionRadius(const double &collisionRadius)
+{
+	m_collisionRadius = collisionRadius;
+	invalidateSensors();
+}
+
+const double &Robot::collisionRadius() const
+{
+	return m_collisionRadius;
 }
 
 Robot::~Robot()
@@ -156,26 +212,82 @@ const double &Robot::wheelRadii() const
 
 void Robot::setLeftSpeed(const double &leftSpeed)
 {
-	update();
+	QMutexLocker locker(&m_mutex);
 	m_leftSpeed = leftSpeed;
 }
 
-const double &Robot::leftSpeed() const
+double Robot::leftSpeed() const
 {
+	QMutexLocker locker(&m_mutex);
 	return m_leftSpeed;
 }
 
 void Robot::setRightSpeed(const double &rightSpeed)
 {
-	update();
+	QMutexLocker locker(&m_mutex);
 	m_rightSpeed = rightSpeed;
 }
 
-const double &Robot::rightSpeed() const
+double Robot::rightSpeed() const
 {
+	QMutexLocker locker(&m_mutex);
 	return m_rightSpeed;
 }
 
+void Robot::setPosition(const QPointF &position)
+{
+	QMutexLocker locker(&m_mutex);
+	m_x = position.x();
+	m_y = position.y();
+	invalidateSensors();
+}
+
+QPointF Robot::position() const
+{
+	QMutexLocker locker(&m_mutex);
+	return QPointF(m_x, m_y);
+}
+
+void Robot::setRotation(const double &rotation)
+{
+	QMutexLocker locker(&m_mutex);
+	m_rotation = rotation;
+	invalidateSensors();
+}
+
+double Robot::rotation() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_rotation;
+}
+
+Robot::Kinematics Robot::kinematics() const
+{
+	QMutexLocker locker(&m_mutex);
+	Kinematics ret;
+	ret.x = m_x;
+	ret.y = m_y;
+	ret.rotation = m_rotation;
+	ret.leftSpeed = m_leftSpeed;
+	ret.rightSpeed = m_rightSpeed;
+	ret.leftTravelDistance = m_leftTravelDistance;
+	ret.rightTravelDistance = m_rightTravelDistance;
+	return ret;
+}
+
+void Robot::setKinematics(const Kinematics &kinematics)
+{
+	QMutexLocker locker(&m_mutex);
+	m_x = kinematics.x;
+	m_y = kinematics.y;
+	m_rotation = kinematics.rotation;
+	m_leftSpeed = kinematics.leftSpeed;
+	m_rightSpeed = kinematics.rightSpeed;
+	m_leftTravelDistance = kinematics.leftTravelDistance;
+	m_rightTravelDistance = kinematics.rightTravelDistance;
+	invalidateSensors();
+}
+
 void Robot::setLeftTravelDistance(double leftTravelDistance)
 {
 	m_leftTravelDistance = leftTravelDistance;
@@ -199,7 +311,7 @@ double Robot::rightTravelDistance() const
 void Robot::setRangeLength(const double &rangeLength)
 {
 	m_rangeLength = rangeLength;
-	updateRangeLines();
+	invalidateSensors();
 }
 
 const double &Robot::rangeLength() const
@@ -209,62 +321,150 @@ const double &Robot::rangeLength() const
 
 double Robot::leftRange() const
 {
-	return m_leftRange->line().length();
+	if(m_stale & RangeStale) updateRanges();
+	return m_ranges[0];
 }
 
 double Robot::frontRange() const
 {
-	return m_frontRange->line().length();
+	if(m_stale & RangeStale) updateRanges();
+	return m_ranges[1];
 }
 
 double Robot::rightRange() const
 {
-	return m_rightRange->line().length();
+	if(m_stale & RangeStale) updateRanges();
+	return m_ranges[2];
+}
+
+Rangefinder *Robot::rangefinder()
+{
+	return &m_rangefinder;
+}
+
+const QVector<double> &Robot::scan() const
+{
+	if(m_stale & ScanStale) {
+		m_rangefinder.scan(m_walls, QPointF(m_x, m_y), m_rotation);
+		m_stale &= ~ScanStale;
+	}
+	return m_rangefinder.readings();
 }
 
 
 double Robot::leftReflectance() const
 {
+	if(m_stale & LeftReflectanceStale) {
+		m_leftReflectance = reflectanceAt(-30.0);
+		m_stale &= ~LeftReflectanceStale;
+	}
 	return m_leftReflectance;
 }
 
 double Robot::rightReflectance() const
 {
+	if(m_stale & RightReflectanceStale) {
+		m_rightReflectance = reflectanceAt(30.0);
+		m_stale &= ~RightReflectanceStale;
+	}
 	return m_rightReflectance;
 }
 
-
-void Robot::update()
+bool Robot::leftBump() const
 {
-	int milli = m_time.elapsed();
-	double sec = milli / 1000.0;
-	
-	const double theta = m_robot->rotation() / 180.0 * M_PI;
-	
-	double dl = sec * m_leftSpeed * m_wheelRadii * 2.0 * M_PI;
-	double dr = sec * m_rightSpeed * m_wheelRadii * 2.0 * M_PI;
-	double dd = (dl + dr) / 2.0;
-	m_robot->setRotation((theta + (dr - dl) / m_wheelDiameter) * 180.0 / M_PI);
-	m_leftTravelDistance += dl;
-	m_rightTravelDistance += dr;
+	if(m_stale & BumpStale) updateBumps();
+	return m_leftBump;
+}
 
-	double newX = m_robot->x() + cos(theta) * dd;
-	double newY = m_robot->y() + sin(theta) * dd;
+bool Robot::rightBump() const
+{
+	if(m_stale & BumpStale) updateBumps();
+	return m_rightBump;
+}
 
-	m_robot->setX(newX);
-	m_robot->setY(newY);
 
+void Robot::update(const double &sec, const quint32 &steps)
+{
+	QMutexLocker locker(&m_mutex);
+	for(quint32 i = 0; i < steps; ++i) advance(sec);
+	invalidateSensors();
+}
 
-	updateRangeLines();
-	updateReflectances();
+void Robot::advance(const double &sec)
+{
+	if(sec <= 0.0) return;
+	
+	const double dl = sec * m_leftSpeed * m_wheelRadii * 2.0 * M_PI;
+	const double dr = sec * m_rightSpeed * m_wheelRadii * 2.0 * M_PI;
+	m_leftTravelDistance += dl;
+	m_rightTravelDistance += dr;
+	
+	// Wheel speeds are constant over the interval, so the robot follows a
+	// single arc. Every sub-step moves along the exact chord of its piece
+	// of that arc, which lands on the arc itself; sub-stepping only bounds
+	// how far each collision sweep strays from the true path.
+	const double turn = (dr - dl) / m_wheelDiameter;
+	const double distance = (dl + dr) / 2.0;
+	quint32 steps = 1;
+	if(m_walls) {
+		steps = qMax(steps, static_cast<quint32>(ceil(fabs(turn) / maxStepTurn)));
+		steps = qMax(steps, static_cast<quint32>(ceil(fabs(distance) / maxStepDistance)));
+	}
 	
+	const double half = turn / steps / 2.0;
+	const double sinc = fabs(half) < 1e-6 ? 1.0 - half * half / 6.0 : sin(half) / half;
+	const double chord = distance / steps * sinc;
+	
+	double theta = m_rotation / 180.0 * M_PI;
+	QPointF pos(m_x, m_y);
+	for(quint32 i = 0; i < steps; ++i) {
+		const double direction = theta + half;
+		moveBy(pos, QPointF(cos(direction), sin(direction)) * chord);
+		theta += 2.0 * half;
+	}
+	
+	// Keep the heading bounded so long runs don't lose precision
+	m_rotation = fmod(theta * 180.0 / M_PI, 360.0);
+	m_x = pos.x();
+	m_y = pos.y();
+}
 
-	m_time.restart();
+void Robot::moveBy(QPointF &pos, QPointF delta) const
+{
+	if(!m_walls) {
+		pos += delta;
+		return;
+	}
+	
+	// Stop at the first wall, then slide the rest of the motion along it
+	for(int i = 0; i < maxSlides && (delta.x() != 0.0 || delta.y() != 0.0); ++i) {
+		QPointF normal;
+		const double t = m_walls->sweep(pos, delta, m_collisionRadius, &normal);
+		if(t >= 1.0) {
+			pos += delta;
+			return;
+		}
+		pos += delta * t + normal * collisionSkin;
+		delta *= 1.0 - t;
+		delta -= normal * QPointF::dotProduct(delta, normal);
+	}
 }
 
-void Robot::restartTime()
+void Robot::syncGraphics(const QPointF &position, const double &rotation)
 {
-  m_time.restart();
+	m_robot->setPos(position);
+	m_robot->setRotation(rotation);
+	
+	// Cast again rather than sharing the simulation's readings, which
+	// belong to the simulation thread
+	QGraphicsLineItem *const items[3] = { m_leftRange, m_frontRange, m_rightRange };
+	double dx[3];
+	double dy[3];
+	double ranges[3];
+	castRanges(position, rotation, dx, dy, ranges);
+	for(int i = 0; i < 3; ++i) {
+		items[i]->setLine(QLineF(position, position + ranges[i] * QPointF(dx[i], dy[i])));
+	}
 }
 
 QList<QGraphicsItem *> Robot::robot() const
@@ -272,11 +472,9 @@ QList<QGraphicsItem *> Robot::robot() const
 	return QList<QGraphicsItem *>() << m_robot << m_leftRange << m_frontRange << m_rightRange;
 }
 
-void Robot::updateRangeLines()
+void Robot::invalidateSensors()
 {
-	m_leftRange->setLine(intersectDistance(m_leftRange, -45.0));
-	m_frontRange->setLine(intersectDistance(m_frontRange, 0.0));
-	m_rightRange->setLine(intersectDistance(m_rightRange, 45.0));
+	m_stale = AllSensorsStale;
 }
 
 
@@ -289,74 +487,70 @@ T sign(T t)
 	return 0;
 }
 
-void Robot::updateReflectances()
+void Robot::updateBumps() const
 {
-	const double sensor_dist = 10;
+	m_leftBump = false;
+	m_rightBump = false;
+	m_stale &= ~BumpStale;
+	if(!m_walls) return;
+	
+	const double heading = m_rotation / 180.0 * M_PI;
+	foreach(const QPointF &dir, m_walls->contacts(QPointF(m_x, m_y), m_collisionRadius, contactSlop)) {
+		// Bearing of the contact from the heading; negative is to the left
+		double bearing = atan2(dir.y(), dir.x()) - heading;
+		bearing = atan2(sin(bearing), cos(bearing));
+		if(bearing >= -bumpArc && bearing <= bumpOverlap) m_leftBump = true;
+		if(bearing <= bumpArc && bearing >= -bumpOverlap) m_rightBump = true;
+	}
+}
 
-	// left reflectance update
-	const double radLeft = (m_robot->rotation() - 30) / 180.0 * M_PI;
-	const double leftSensorX = m_robot->x() + cos(radLeft) * sensor_dist;
-	const double leftSensorY = m_robot->y() + sin(radLeft) * sensor_dist;
-	m_leftReflectance = reflectanceReading(leftSensorX, leftSensorY);
+double Robot::reflectanceAt(const double &baseAngle) const
+{
+	const double sensor_dist = 10;
 
-	// right reflectance update
-	const double radRight = (m_robot->rotation() + 30) / 180.0 * M_PI;
-	const double rightSensorX = m_robot->x() + cos(radRight) * sensor_dist;
-	const double rightSensorY = m_robot->y() + sin(radRight) * sensor_dist;
-	m_rightReflectance = reflectanceReading(rightSensorX, rightSensorY);
+	const double rad = (m_rotation + baseAngle) / 180.0 * M_PI;
+	const double sensorX = m_x + cos(rad) * sensor_dist;
+	const double sensorY = m_y + sin(rad) * sensor_dist;
+	return reflectanceReading(sensorX, sensorY);
 }
 
-double Robot::reflectanceReading(double sensorX, double sensorY)
+double Robot::reflectanceReading(double sensorX, double sensorY) const
 {
 	double result = 0.0;
 	double weight = 1.0 / num_pts;
 	double spiral_scale = 2.0;
 
-	QGraphicsScene *scene = m_leftRange->scene();
+	if(!m_walls) return result;
 
+	// Every tape under a point of the spiral counts, as the board scene's
+	// items would; the scene itself belongs to the GUI thread
 	for (int i = 0; i < num_pts; i++){
-		double spiralX = spiral_xs[i]*spiral_scale + sensorX;
-		double spiralY = spiral_ys[i]*spiral_scale + sensorY;
-
-		QRectF r(QPoint(spiralX, spiralY), QSize(1,1));
-
-		QList<QGraphicsItem *> items = scene->items(r, Qt::IntersectsItemBoundingRect, Qt::AscendingOrder);
-		foreach(QGraphicsItem *t, items) {
-			if(t->data(0) == BoardFile::Tape) {
-				result += weight;
-				continue;
-			}
-		}
+		const int spiralX = spiral_xs[i]*spiral_scale + sensorX;
+		const int spiralY = spiral_ys[i]*spiral_scale + sensorY;
+		result += weight * m_walls->tapesAt(spiralX, spiralY);
 	}
 
 	return result;
 }
 
-QLineF Robot::intersectDistance(QGraphicsLineItem *item, const double &baseAngle) const
+void Robot::castRanges(const QPointF &origin, const double &rotation, double *const dx, double *const dy,
+	double *const ranges) const
 {
-	QGraphicsScene *scene = item->scene();
-	if(!scene) return QLineF(0, 0, 0, 0);
-	
-	const double rad = (m_robot->rotation() + baseAngle) / 180.0 * M_PI;
-	QLineF line(m_robot->pos(), m_robot->pos() + m_rangeLength *
-		QPointF(cos(rad), sin(rad)));
-	
-	const QLineF unit = line.unitVector();
-	// qDebug() << unit.dx();
-	double xs = unit.dx();
-	double ys = unit.dy();
-	if(xs == 0.0) xs = 0.0001;
-	if(ys == 0.0) ys = 0.0001;
-	for(double i = 0; i < m_rangeLength; i += 1.0) {
-		QRectF r(m_robot->x() + i * xs, m_robot->y() + i * ys, xs, ys);
-		QList<QGraphicsItem *> items = scene->items(r, Qt::IntersectsItemBoundingRect, Qt::AscendingOrder);
-		foreach(QGraphicsItem *t, items) {
-			if(t->data(0) == BoardFile::Real) {
-				line.setLength(i);
-				return line;
-			}
-		}
+	// All three range sensors are cast as one batch
+	static const double angles[3] = { -45.0, 0.0, 45.0 };
+	for(int i = 0; i < 3; ++i) {
+		const double rad = (rotation + angles[i]) / 180.0 * M_PI;
+		dx[i] = cos(rad);
+		dy[i] = sin(rad);
+		ranges[i] = 0.0;
 	}
-	
-	return line;
+	if(m_walls) m_walls->cast(origin, dx, dy, 3, m_rangeLength, ranges);
+}
+
+void Robot::updateRanges() const
+{
+	m_stale &= ~RangeStale;
+	double dx[3];
+	double dy[3];
+	castRanges(QPointF(m_x, m_y), m_rotation, dx, dy, m_ranges);
 }
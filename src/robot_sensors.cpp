@@ -0,0 +1,175 @@
+#define _USE_MATH_DEFINES
+
+#include "robot_sensors.hpp"
+#include "robot.hpp"
+#include "light.hpp"
+#include "kovan_regs_p.hpp"
+#include "trace.hpp"
+
+#include <QLineF>
+
+#include <cmath>
+
+static const int analogRegs[8] = {
+  AN_IN_0,
+  AN_IN_1,
+  AN_IN_2,
+  AN_IN_3,
+  AN_IN_4,
+  AN_IN_5,
+  AN_IN_6,
+  AN_IN_7
+};
+
+RobotSensors::RobotSensors(Robot *const robot, Light *const light)
+  : _robot(robot)
+  , _light(light)
+  , _analogRouteCount(0)
+  , _analogRoles(0)
+  , _digitalRouteCount(0)
+  , _digitalRoles(0)
+  , _digitalMask(0)
+  , _analogValid(0)
+  , _digitalValid(0)
+{
+}
+
+void RobotSensors::setAnalogMapping(const QMap<int, int> &mapping)
+{
+  _analogRouteCount = 0;
+  _analogRoles = 0;
+  QMap<int, int>::const_iterator it = mapping.constBegin();
+  for(; it != mapping.constEnd() && _analogRouteCount < 8; ++it) {
+    if(it.key() < 0 || it.key() > 7) continue;
+    if(it.value() < 0 || it.value() >= AnalogRoleCount) continue;
+    Route &route = _analogRoutes[_analogRouteCount++];
+    route.role = it.value();
+    route.reg = analogRegs[it.key()];
+    _analogRoles |= 1 << route.role;
+  }
+}
+
+void RobotSensors::setDigitalMapping(const QMap<int, int> &mapping)
+{
+  _digitalRouteCount = 0;
+  _digitalRoles = 0;
+  _digitalMask = 0;
+  QMap<int, int>::const_iterator it = mapping.constBegin();
+  for(; it != mapping.constEnd() && _digitalRouteCount < 8; ++it) {
+    if(it.key() < 0 || it.key() > 7) continue;
+    if(it.value() < 0 || it.value() >= DigitalRoleCount) continue;
+    Route &route = _digitalRoutes[_digitalRouteCount++];
+    route.role = it.value();
+    // DIG_IN stores port 0 in its most significant used bit
+    route.reg = 7 - it.key();
+    _digitalRoles |= 1 << route.role;
+    _digitalMask |= 1 << route.reg;
+  }
+}
+
+void RobotSensors::invalidate()
+{
+  _analogValid = 0;
+  _digitalValid = 0;
+}
+
+unsigned short RobotSensors::analog(const AnalogRole role)
+{
+  if(!(_analogValid & (1 << role))) {
+    _analogs[role] = evaluateAnalog(role);
+    _analogValid |= 1 << role;
+  }
+  return _analogs[role];
+}
+
+bool RobotSensors::digital(const DigitalRole role)
+{
+  if(!(_digitalValid & (1 << role))) {
+    _digitals[role] = evaluateDigital(role);
+    _digitalValid |= 1 << role;
+  }
+  return _digitals[role];
+}
+
+void RobotSensors::sample(Kovan::State &state)
+{
+  TRACE_SPAN("sensors.sample");
+  
+  // Bring every routed role up to date once, then fan the values out
+  for(quint8 role = 0; role < AnalogRoleCount; ++role) {
+    if(_analogRoles & (1 << role)) analog(static_cast<AnalogRole>(role));
+  }
+  for(quint8 role = 0; role < DigitalRoleCount; ++role) {
+    if(_digitalRoles & (1 << role)) digital(static_cast<DigitalRole>(role));
+  }
+  
+  for(quint8 i = 0; i < _analogRouteCount; ++i) {
+    state.t[_analogRoutes[i].reg] = _analogs[_analogRoutes[i].role];
+  }
+  
+  // Digital inputs are pulled up, so a pressed sensor reads as a cleared bit
+  unsigned short pressed = 0;
+  for(quint8 i = 0; i < _digitalRouteCount; ++i) {
+    pressed |= _digitals[_digitalRoutes[i].role] << _digitalRoutes[i].reg;
+  }
+  state.t[DIG_IN] = (state.t[DIG_IN] | _digitalMask) & ~pressed;
+  
+  // Beams beyond the register window are still available from Robot::scan()
+  const quint32 beams = qMin<quint32>(_robot->rangefinder()->beams(), SCAN_RANGE_END - SCAN_RANGE_START + 1);
+  state.t[SCAN_BEAM_COUNT] = beams;
+  if(beams) {
+    const QVector<double> &scan = _robot->scan();
+    const double scale = 1023.0 / _robot->rangefinder()->range();
+    for(quint32 i = 0; i < beams; ++i) state.t[SCAN_RANGE_START + i] = scan[i] * scale;
+  }
+}
+
+unsigned short RobotSensors::evaluateAnalog(const AnalogRole role) const
+{
+  static const char *const spans[AnalogRoleCount] = {
+    "sensors.range", "sensors.range", "sensors.range",
+    "sensors.light", "sensors.light",
+    "sensors.reflectance", "sensors.reflectance"
+  };
+  TRACE_SPAN(role < AnalogRoleCount ? spans[role] : "sensors");
+  
+  switch(role) {
+  case LeftRange: return _robot->leftRange() / _robot->rangeLength() * 1023.0;
+  case FrontRange: return _robot->frontRange() / _robot->rangeLength() * 1023.0;
+  case RightRange: return _robot->rightRange() / _robot->rangeLength() * 1023.0;
+  case LeftLight: return light(45.0);
+  case RightLight: return light(-45.0);
+  case LeftReflectance: return _robot->leftReflectance() * 1023.0;
+  case RightReflectance: return _robot->rightReflectance() * 1023.0;
+  default: break;
+  }
+  return 0;
+}
+
+bool RobotSensors::evaluateDigital(const DigitalRole role)
+{
+  TRACE_SPAN("sensors.touch");
+  switch(role) {
+  case LeftTouch: return _robot->leftBump();
+  case RightTouch: return _robot->rightBump();
+  default: break;
+  }
+  return false;
+}
+
+unsigned short RobotSensors::light(const double &baseAngle) const
+{
+  // The light is dragged around on the GUI thread while this may run on
+  // the simulation thread
+  QPointF lightPos;
+  bool on = false;
+  _light->sensorState(lightPos, on);
+  if(!on) return 1023;
+  
+  const static double lightDisp = 15.0;
+  
+  const double rad = M_PI * (_robot->rotation() + baseAngle) / 180.0;
+  const QPointF sensorPos = _robot->position() + lightDisp * QPointF(cos(rad), sin(rad));
+  const double value = QLineF(sensorPos, lightPos).length() / 50.0 * 1023.0;
+  return value > 1023.0 ? 1023 : value;
+}
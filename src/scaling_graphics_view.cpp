@@ -1,8 +1,37 @@
 #include "scaling_graphics_view.hpp"
+#include "trace.hpp"
+
+#include <QGraphicsScene>
 
 ScalingGraphicsView::ScalingGraphicsView(QWidget *parent)
-	: QGraphicsView(parent)
+	: QGraphicsView(parent),
+	m_board(0)
+{
+	// The board only has to be rasterized again when the transform changes
+	setCacheMode(QGraphicsView::CacheBackground);
+}
+
+void ScalingGraphicsView::setBoardScene(QGraphicsScene *board)
+{
+	if(m_board) m_board->disconnect(this);
+	m_board = board;
+	if(m_board) {
+		connect(m_board, SIGNAL(changed(QList<QRectF>)),
+			SLOT(boardChanged(QList<QRectF>)));
+	}
+	resetCachedContent();
+	viewport()->update();
+}
+
+QGraphicsScene *ScalingGraphicsView::boardScene() const
+{
+	return m_board;
+}
+
+void ScalingGraphicsView::boardChanged(const QList<QRectF> &region)
 {
+	// Only re-rasterize the parts of the cached background that changed
+	foreach(const QRectF &rect, region) invalidateScene(rect, QGraphicsScene::BackgroundLayer);
 }
 
 void ScalingGraphicsView::resizeEvent(QResizeEvent *event)
@@ -14,4 +43,18 @@ void ScalingGraphicsView::resizeEvent(QResizeEvent *event)
 	QTransform transform;
 	transform.scale(minW / maxS * 0.9, minW / maxS * 0.9);
 	setTransform(transform);
+}
+
+void ScalingGraphicsView::paintEvent(QPaintEvent *event)
+{
+	TRACE_SPAN("paint");
+	QGraphicsView::paintEvent(event);
+}
+
+void ScalingGraphicsView::drawBackground(QPainter *painter, const QRectF &rect)
+{
+	TRACE_SPAN("paint.board");
+	QGraphicsView::drawBackground(painter, rect);
+	if(!m_board) return;
+	m_board->render(painter, rect, rect, Qt::IgnoreAspectRatio);
 }
\ No newline at end of file
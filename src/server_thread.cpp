@@ -1,6 +1,8 @@
 #include "server_thread.hpp"
 
 #include "compile_worker.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
 
 #include <kovanserial/tcp_server.hpp>
 #include <kovanserial/kovan_serial.hpp>
@@ -108,6 +110,7 @@ bool ServerThread::handleUntrusted(const Packet &p)
 
 void ServerThread::handleArchive(const Packet &headerPacket)
 {
+	TRACE_SPAN("server.archive");
 	quint64 start = msystime();
 	
 	Command::FileHeaderData header;
@@ -132,6 +135,8 @@ void ServerThread::handleArchive(const Packet &headerPacket)
 	quint64 end = msystime();
 	qDebug() << "Header size: " << header.size;
 	qDebug() << "Took" << (end - start) << "milliseconds to recv";
+	Metrics::uploadSize.record(header.size);
+	Metrics::uploadDuration.record((end - start) * 1000000);
 	
 	// Load up the archive
 	kiss::Kar *archive = new kiss::Kar();
@@ -150,6 +155,7 @@ void ServerThread::handleArchive(const Packet &headerPacket)
 
 void ServerThread::handleAction(const Packet &action)
 {
+	TRACE_SPAN("server.action");
 	using namespace Compiler;
 	
 	Command::FileActionData data;
@@ -161,6 +167,7 @@ void ServerThread::handleAction(const Packet &action)
 	if(!m_proto->confirmFileAction(good) || !good) return;
 
 	if(type == COMMAND_ACTION_COMPILE) {
+		const quint64 compileStart = msystime();
 		const QString archivePath = m_userRoot + "/archives/" + name;
 		const kiss::KarPtr archive = kiss::Kar::load(archivePath);
 		
@@ -188,6 +195,7 @@ void ServerThread::handleAction(const Packet &action)
 		}
 		
 		output << RootManager(m_userRoot).install(output, name);
+		Metrics::compileDuration.record((msystime() - compileStart) * 1000000);
     
     for(int i = 0; i < output.size(); ++i) {
       const Output &o = output.at(i);
@@ -0,0 +1,257 @@
+#include "simulation_thread.hpp"
+
+#include "kovan_kmod_sim.hpp"
+#include "robot.hpp"
+#include "robot_sensors.hpp"
+#include "telemetry.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
+
+#include <QElapsedTimer>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QPointF>
+
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <sys/timerfd.h>
+#include <stdint.h>
+#include <unistd.h>
+#endif
+
+// Ticks missed beyond this are dropped instead of simulated in a burst
+#define MAX_CATCH_UP_TICKS 10
+
+SimulationThread::SimulationThread(Kovan::KmodSim *kmod, Robot *robot, RobotSensors *sensors, QObject *parent)
+	: QThread(parent),
+	m_kmod(kmod),
+	m_robot(robot),
+	m_sensors(sensors),
+	m_telemetry(0),
+	m_rate(1000),
+	m_stop(0),
+	m_tick(0),
+	m_time(0.0)
+{
+	m_wheels[0] = -1;
+	m_wheels[1] = -1;
+	memset(&m_snapshot, 0, sizeof(Snapshot));
+	memset(&m_stats, 0, sizeof(Stats));
+}
+
+SimulationThread::~SimulationThread()
+{
+	stop();
+}
+
+void SimulationThread::setRate(const unsigned int hz)
+{
+	m_rate.store(hz ? hz : 1);
+}
+
+unsigned int SimulationThread::rate() const
+{
+	return m_rate.load();
+}
+
+void SimulationThread::setWheelChannels(const int left, const int right)
+{
+	QMutexLocker locker(m_kmod->mutex());
+	m_wheels[0] = left;
+	m_wheels[1] = right;
+}
+
+void SimulationThread::clock(quint64 &tick, double &time) const
+{
+	tick = m_tick;
+	time = m_time;
+}
+
+void SimulationThread::setClock(const quint64 tick, const double time)
+{
+	m_tick = tick;
+	m_time = time;
+}
+
+void SimulationThread::setTelemetry(Telemetry *telemetry)
+{
+	QMutexLocker locker(m_kmod->mutex());
+	m_telemetry = telemetry;
+}
+
+SimulationThread::Snapshot SimulationThread::snapshot() const
+{
+	QMutexLocker locker(&m_publishMutex);
+	return m_snapshot;
+}
+
+SimulationThread::Stats SimulationThread::stats() const
+{
+	QMutexLocker locker(&m_publishMutex);
+	return m_stats;
+}
+
+void SimulationThread::resetStats()
+{
+	QMutexLocker locker(&m_publishMutex);
+	memset(&m_stats, 0, sizeof(Stats));
+}
+
+void SimulationThread::stop()
+{
+	m_stop.store(1);
+	wait();
+	m_stop.store(0);
+}
+
+void SimulationThread::run()
+{
+	QElapsedTimer clock;
+	clock.start();
+	
+#ifdef Q_OS_LINUX
+	const int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if(fd < 0) qWarning() << "timerfd_create failed, falling back to sleeping";
+#else
+	const int fd = -1;
+#endif
+	
+	int armedRate = 0;
+	qint64 period = 0;
+	qint64 deadline = 0;
+	
+	while(!m_stop.load()) {
+		const int hz = m_rate.load();
+		if(hz != armedRate) {
+			armedRate = hz;
+			period = 1000000000LL / hz;
+			deadline = clock.nsecsElapsed() + period;
+#ifdef Q_OS_LINUX
+			if(fd >= 0) {
+				itimerspec spec;
+				spec.it_interval.tv_sec = period / 1000000000LL;
+				spec.it_interval.tv_nsec = period % 1000000000LL;
+				spec.it_value = spec.it_interval;
+				timerfd_settime(fd, 0, &spec, 0);
+			}
+#endif
+		}
+		
+		quint64 expirations = 1;
+#ifdef Q_OS_LINUX
+		if(fd >= 0) {
+			uint64_t count = 0;
+			if(::read(fd, &count, sizeof(count)) != sizeof(count)) continue;
+			expirations = count;
+		} else
+#endif
+		{
+			// Portable fallback; only as precise as the platform's sleep
+			qint64 remaining = deadline - clock.nsecsElapsed();
+			while(remaining > 0) {
+				if(remaining > 1000) QThread::usleep(remaining / 1000);
+				else QThread::yieldCurrentThread();
+				remaining = deadline - clock.nsecsElapsed();
+			}
+			expirations = 1 + (clock.nsecsElapsed() - deadline) / period;
+			deadline += expirations * period;
+		}
+		
+		const double dt = period / 1000000000.0;
+		const quint64 steps = qMin<quint64>(expirations, MAX_CATCH_UP_TICKS);
+		const qint64 start = clock.nsecsElapsed();
+		qint64 tickStart = start;
+		qint64 longest = 0;
+		for(quint64 i = 0; i < steps; ++i) {
+			tick(dt);
+			const qint64 tickEnd = clock.nsecsElapsed();
+			Metrics::tickDuration.record(tickEnd - tickStart);
+			longest = qMax(longest, tickEnd - tickStart);
+			tickStart = tickEnd;
+		}
+		Metrics::ticks.add(steps);
+		Metrics::tickOverruns.add(expirations - 1);
+		publish(steps, tickStart - start, longest, expirations - 1);
+	}
+	
+#ifdef Q_OS_LINUX
+	if(fd >= 0) ::close(fd);
+#endif
+}
+
+void SimulationThread::tick(const double dt)
+{
+	TRACE_SPAN("tick");
+	QMutexLocker locker(m_kmod->mutex());
+	{
+		TRACE_SPAN("tick.motors");
+		m_kmod->step(dt);
+	}
+	if(m_wheels[0] >= 0) m_robot->setLeftSpeed(m_kmod->motorSpeed(m_wheels[0]));
+	if(m_wheels[1] >= 0) m_robot->setRightSpeed(m_kmod->motorSpeed(m_wheels[1]));
+	{
+		TRACE_SPAN("tick.robot");
+		m_robot->update(dt);
+	}
+	
+	// Sensors are evaluated lazily when the controller next reads them
+	m_sensors->invalidate();
+	
+	++m_tick;
+	m_time += dt;
+	
+	if(m_telemetry) record();
+	
+	// A tick is what changes the sensors a held wait command watches
+	m_kmod->serviceWaits();
+}
+
+void SimulationThread::record()
+{
+	TRACE_SPAN("tick.telemetry");
+	
+	// Forces every sensor to be evaluated this tick; the controller's next
+	// read reuses the same memoized values. Sensors only read the board's
+	// Walls and the light's published state, never a graphics item.
+	Telemetry::Sample sample;
+	sample.tick = m_tick;
+	sample.time = m_time;
+	const QPointF position = m_robot->position();
+	sample.x = position.x();
+	sample.y = position.y();
+	sample.rotation = m_robot->rotation();
+	for(unsigned char i = 0; i < 4; ++i) sample.motors[i] = m_kmod->motorOutput(i);
+	for(int i = 0; i < RobotSensors::AnalogRoleCount; ++i) {
+		sample.analogs[i] = m_sensors->analog(static_cast<RobotSensors::AnalogRole>(i));
+	}
+	sample.digitals = 0;
+	for(int i = 0; i < RobotSensors::DigitalRoleCount; ++i) {
+		if(m_sensors->digital(static_cast<RobotSensors::DigitalRole>(i))) sample.digitals |= 1 << i;
+	}
+	m_telemetry->append(sample);
+}
+
+void SimulationThread::publish(const quint64 steps, const qint64 stepsNs, const qint64 longestNs,
+	const quint64 overruns)
+{
+	Snapshot snapshot;
+	{
+		QMutexLocker locker(m_kmod->mutex());
+		snapshot.tick = m_tick;
+		snapshot.time = m_time;
+		const QPointF position = m_robot->position();
+		snapshot.x = position.x();
+		snapshot.y = position.y();
+		snapshot.rotation = m_robot->rotation();
+		for(unsigned char i = 0; i < 4; ++i) snapshot.motorOutputs[i] = m_kmod->motorOutput(i);
+	}
+	
+	QMutexLocker locker(&m_publishMutex);
+	m_snapshot = snapshot;
+	m_stats.ticks += steps;
+	m_stats.overruns += overruns;
+	m_stats.lastTickNs = stepsNs / steps;
+	m_stats.totalTickNs += stepsNs;
+	if(longestNs > m_stats.maxTickNs) m_stats.maxTickNs = longestNs;
+}
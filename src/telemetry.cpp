@@ -0,0 +1,293 @@
+#include "telemetry.hpp"
+
+#include <QDebug>
+#include <cmath>
+#include <cstring>
+
+#define FILE_MAGIC 0x4D54534B
+#define CHUNK_MAGIC 0x4B4E4843
+#define FILE_VERSION 1
+
+// A zigzag varint of a 64 bit delta takes at most this many bytes
+#define MAX_VARINT_SIZE 10
+
+static const char *const columnNames[Telemetry::ColumnCount] = {
+  "tick", "time",
+  "x", "y", "rotation",
+  "motor0", "motor1", "motor2", "motor3",
+  "left_range", "front_range", "right_range",
+  "left_light", "right_light",
+  "left_reflectance", "right_reflectance",
+  "digitals"
+};
+
+// Resolution of every column in its unit (ticks, seconds, cm, radians,
+// motor output, raw sensor value)
+static const double columnScales[Telemetry::ColumnCount] = {
+  1.0, 1e-6,
+  1e-3, 1e-3, 1e-6,
+  1e-4, 1e-4, 1e-4, 1e-4,
+  1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,
+  1.0
+};
+
+static qint64 quantize(const Telemetry::Sample &sample, const int column)
+{
+  double value = 0.0;
+  switch(column) {
+  case Telemetry::TickColumn: return sample.tick;
+  case Telemetry::TimeColumn: value = sample.time; break;
+  case Telemetry::XColumn: value = sample.x; break;
+  case Telemetry::YColumn: value = sample.y; break;
+  case Telemetry::RotationColumn: value = sample.rotation; break;
+  case Telemetry::DigitalColumn: return sample.digitals;
+  default:
+    if(column < Telemetry::AnalogColumn) value = sample.motors[column - Telemetry::MotorColumn];
+    else return sample.analogs[column - Telemetry::AnalogColumn];
+  }
+  return qint64(floor(value / columnScales[column] + 0.5));
+}
+
+static void restore(Telemetry::Sample &sample, const int column, const qint64 raw)
+{
+  const double value = raw * columnScales[column];
+  switch(column) {
+  case Telemetry::TickColumn: sample.tick = raw; break;
+  case Telemetry::TimeColumn: sample.time = value; break;
+  case Telemetry::XColumn: sample.x = value; break;
+  case Telemetry::YColumn: sample.y = value; break;
+  case Telemetry::RotationColumn: sample.rotation = value; break;
+  case Telemetry::DigitalColumn: sample.digitals = raw; break;
+  default:
+    if(column < Telemetry::AnalogColumn) sample.motors[column - Telemetry::MotorColumn] = value;
+    else sample.analogs[column - Telemetry::AnalogColumn] = raw;
+  }
+}
+
+static char *putVarint(char *out, const qint64 delta)
+{
+  quint64 v = (quint64(delta) << 1) ^ quint64(delta >> 63);
+  while(v >= 0x80) {
+    *out++ = char(v | 0x80);
+    v >>= 7;
+  }
+  *out++ = char(v);
+  return out;
+}
+
+static bool getVarint(const uchar *&in, const uchar *const end, qint64 &delta)
+{
+  quint64 v = 0;
+  for(int shift = 0; in < end && shift < 64; shift += 7) {
+    const uchar byte = *in++;
+    v |= quint64(byte & 0x7F) << shift;
+    if(byte & 0x80) continue;
+    delta = qint64(v >> 1) ^ -qint64(v & 1);
+    return true;
+  }
+  return false;
+}
+
+Telemetry::Telemetry(QObject *const parent)
+  : QThread(parent)
+  , _current(-1)
+  , _next(0)
+  , _fill(0)
+{
+}
+
+Telemetry::~Telemetry()
+{
+  close();
+}
+
+bool Telemetry::open(const QString &path)
+{
+  close();
+  
+  _file.setFileName(path);
+  if(!_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    qWarning() << "Failed to open telemetry file" << path << _file.errorString();
+    return false;
+  }
+  
+  FileHeader header;
+  header.magic = FILE_MAGIC;
+  header.version = FILE_VERSION;
+  header.columns = ColumnCount;
+  header.chunkSamples = ChunkSamples;
+  _file.write(reinterpret_cast<const char *>(&header), sizeof(FileHeader));
+  for(int i = 0; i < ColumnCount; ++i) {
+    ColumnHeader column;
+    memset(&column, 0, sizeof(ColumnHeader));
+    strncpy(column.name, columnNames[i], sizeof(column.name) - 1);
+    column.scale = columnScales[i];
+    _file.write(reinterpret_cast<const char *>(&column), sizeof(ColumnHeader));
+  }
+  
+  // Everything either thread touches is allocated up front
+  _ring.resize(Chunks * ChunkSamples);
+  for(int i = 0; i < ColumnCount; ++i) _columns[i].resize(ChunkSamples * MAX_VARINT_SIZE);
+  
+  _free.acquire(_free.available());
+  _full.acquire(_full.available());
+  _free.release(Chunks);
+  _current = -1;
+  _next = 0;
+  _fill = 0;
+  _dropped.store(0);
+  acquireChunk();
+  
+  start(QThread::LowPriority);
+  return true;
+}
+
+void Telemetry::close()
+{
+  if(!isRunning()) return;
+  
+  // The last chunk may be partial or even empty; it only has to carry the flag
+  if(_current < 0) {
+    _free.acquire();
+    _current = _next;
+    _next = (_next + 1) % Chunks;
+    _fill = 0;
+  }
+  publishChunk(_fill | FinalChunk);
+  wait();
+  
+  // Leave nothing for a stray append() to fill
+  _free.acquire(_free.available());
+  _current = -1;
+  
+  _file.close();
+  _ring.clear();
+  for(int i = 0; i < ColumnCount; ++i) _columns[i].clear();
+}
+
+bool Telemetry::isOpen() const
+{
+  return isRunning();
+}
+
+void Telemetry::append(const Sample &sample)
+{
+  if(_current < 0) {
+    acquireChunk();
+    if(_current < 0) {
+      _dropped.ref();
+      return;
+    }
+  }
+  
+  _ring[_current * ChunkSamples + _fill] = sample;
+  if(++_fill == ChunkSamples) publishChunk(ChunkSamples);
+}
+
+quint64 Telemetry::dropped() const
+{
+  return _dropped.load();
+}
+
+void Telemetry::acquireChunk()
+{
+  if(!_free.tryAcquire()) return;
+  _current = _next;
+  _next = (_next + 1) % Chunks;
+  _fill = 0;
+}
+
+void Telemetry::publishChunk(const quint32 size)
+{
+  _sizes[_current] = size;
+  _current = -1;
+  _full.release();
+  acquireChunk();
+}
+
+void Telemetry::run()
+{
+  bool ok = true;
+  for(int chunk = 0;; chunk = (chunk + 1) % Chunks) {
+    _full.acquire();
+    const quint32 size = _sizes[chunk];
+    const quint32 count = size & ~quint32(FinalChunk);
+    if(ok && count) ok = writeChunk(_ring.constData() + chunk * ChunkSamples, count);
+    _free.release();
+    if(size & FinalChunk) break;
+  }
+  
+  _file.flush();
+}
+
+bool Telemetry::writeChunk(const Sample *const samples, const quint32 count)
+{
+  quint32 sizes[ColumnCount];
+  for(int c = 0; c < ColumnCount; ++c) {
+    char *const begin = _columns[c].data();
+    char *out = begin;
+    qint64 previous = 0;
+    for(quint32 i = 0; i < count; ++i) {
+      const qint64 value = quantize(samples[i], c);
+      out = putVarint(out, value - previous);
+      previous = value;
+    }
+    sizes[c] = out - begin;
+  }
+  
+  ChunkHeader header;
+  header.magic = CHUNK_MAGIC;
+  header.samples = count;
+  bool ok = _file.write(reinterpret_cast<const char *>(&header), sizeof(ChunkHeader)) == sizeof(ChunkHeader);
+  ok = ok && _file.write(reinterpret_cast<const char *>(sizes), sizeof(sizes)) == sizeof(sizes);
+  for(int c = 0; ok && c < ColumnCount; ++c) {
+    ok = _file.write(_columns[c].constData(), sizes[c]) == sizes[c];
+  }
+  
+  if(!ok) qWarning() << "Failed to write telemetry to" << _file.fileName() << _file.errorString();
+  return ok;
+}
+
+bool Telemetry::load(const QString &path, QVector<Sample> &samples)
+{
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly)) return false;
+  const QByteArray data = file.readAll();
+  const uchar *in = reinterpret_cast<const uchar *>(data.constData());
+  const uchar *const end = in + data.size();
+  
+  FileHeader header;
+  if(end - in < (qint64)sizeof(FileHeader)) return false;
+  memcpy(&header, in, sizeof(FileHeader));
+  in += sizeof(FileHeader);
+  if(header.magic != FILE_MAGIC || header.version != FILE_VERSION || header.columns != ColumnCount) return false;
+  
+  in += ColumnCount * sizeof(ColumnHeader);
+  
+  samples.clear();
+  while(end - in >= (qint64)(sizeof(ChunkHeader) + ColumnCount * sizeof(quint32))) {
+    ChunkHeader chunk;
+    quint32 sizes[ColumnCount];
+    memcpy(&chunk, in, sizeof(ChunkHeader));
+    memcpy(sizes, in + sizeof(ChunkHeader), sizeof(sizes));
+    in += sizeof(ChunkHeader) + sizeof(sizes);
+    if(chunk.magic != CHUNK_MAGIC) return false;
+  
+    const int first = samples.size();
+    samples.resize(first + chunk.samples);
+    for(int c = 0; c < ColumnCount; ++c) {
+      if(end - in < sizes[c]) return false;
+      const uchar *column = in;
+      qint64 value = 0;
+      for(quint32 i = 0; i < chunk.samples; ++i) {
+        qint64 delta;
+        if(!getVarint(column, in + sizes[c], delta)) return false;
+        value += delta;
+        restore(samples[first + i], c, value);
+      }
+      in += sizes[c];
+    }
+  }
+  
+  return true;
+}
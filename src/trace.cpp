@@ -0,0 +1,188 @@
+#include "trace.hpp"
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QThreadStorage>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+
+// Spans kept per thread before the oldest are overwritten
+#define RING_SIZE 8192
+
+namespace
+{
+  struct Event
+  {
+    const char *name;
+    qint64 start;
+    qint64 end;
+  };
+  
+  struct Ring
+  {
+    quint32 id;
+    QString thread;
+    Event events[RING_SIZE];
+    // Spans recorded, up to RING_SIZE; once the ring is full it cycles
+    // through [RING_SIZE, 2 * RING_SIZE) so it never overflows. The owning
+    // thread is the only writer of both fields.
+    QAtomicInt count;
+    // Trace::clear() calls seen; the ring is empty when this is behind
+    QAtomicInt generation;
+  };
+  
+  // Hands a thread's ring back to the pool when the thread exits. The ring
+  // and its spans survive until another thread takes it over.
+  struct RingHandle
+  {
+    RingHandle(Ring *const ring) : ring(ring) {}
+    ~RingHandle();
+  
+    Ring *ring;
+  };
+  
+  struct Registry
+  {
+    Registry()
+      : nextId(1)
+    {
+      clock.start();
+    }
+  
+    QElapsedTimer clock;
+    QMutex mutex;
+    QVector<Ring *> rings;
+    QVector<Ring *> retired;
+    quint32 nextId;
+  };
+}
+
+Q_GLOBAL_STATIC(Registry, registry)
+static QThreadStorage<RingHandle *> currentRing;
+// Bumped by Trace::clear(); each thread empties its own ring when it sees it
+static QAtomicInt clearGeneration(0);
+
+RingHandle::~RingHandle()
+{
+  Registry *const r = registry();
+  if(!r) return;
+  QMutexLocker locker(&r->mutex);
+  r->retired.append(ring);
+}
+
+static QString threadName()
+{
+  QThread *const thread = QThread::currentThread();
+  if(QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()) return "GUI";
+  if(!thread->objectName().isEmpty()) return thread->objectName();
+  return thread->metaObject()->className();
+}
+
+static Ring *acquireRing()
+{
+  Registry *const r = registry();
+  QMutexLocker locker(&r->mutex);
+  
+  Ring *ring = 0;
+  if(!r->retired.isEmpty()) {
+    ring = r->retired.last();
+    r->retired.removeLast();
+  } else {
+    ring = new Ring;
+    r->rings.append(ring);
+  }
+  
+  ring->id = r->nextId++;
+  ring->thread = threadName();
+  ring->count.store(0);
+  ring->generation.store(clearGeneration.load());
+  return ring;
+}
+
+QAtomicInt Trace::_enabled(0);
+
+void Trace::setEnabled(const bool enabled)
+{
+  // Start the clock before the first span can read it
+  registry();
+  _enabled.store(enabled);
+}
+
+void Trace::clear()
+{
+  clearGeneration.fetchAndAddOrdered(1);
+}
+
+qint64 Trace::now()
+{
+  return registry()->clock.nsecsElapsed();
+}
+
+void Trace::record(const char *const name, const qint64 start)
+{
+  if(!currentRing.hasLocalData()) currentRing.setLocalData(new RingHandle(acquireRing()));
+  Ring *const ring = currentRing.localData()->ring;
+  
+  int count = ring->count.load();
+  const int generation = clearGeneration.load();
+  if(ring->generation.load() != generation) {
+    ring->generation.store(generation);
+    count = 0;
+  }
+  
+  Event &event = ring->events[count % RING_SIZE];
+  event.name = name;
+  event.start = start;
+  event.end = now();
+  ring->count.storeRelease(count + 1 < 2 * RING_SIZE ? count + 1 : RING_SIZE);
+}
+
+bool Trace::dump(const QString &path)
+{
+  QFile file(path);
+  if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+    qWarning() << "Failed to open" << path << file.errorString();
+    return false;
+  }
+  
+  // Spans still being recorded while dumping may be torn; pause tracing so
+  // the rings hold still
+  const bool wasEnabled = isEnabled();
+  _enabled.store(false);
+  
+  QTextStream out(&file);
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  
+  Registry *const r = registry();
+  QMutexLocker locker(&r->mutex);
+  Q_FOREACH(const Ring *const ring, r->rings) {
+    const int count = ring->count.loadAcquire();
+    if(!count || ring->generation.load() != clearGeneration.load()) continue;
+  
+    if(!first) out << ",";
+    first = false;
+    QString name = ring->thread;
+    name.replace('\\', "\\\\").replace('"', "\\\"");
+    out << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << ring->id
+      << ",\"args\":{\"name\":\"" << name << "\"}}";
+  
+    for(int i = qMax(0, count - RING_SIZE); i < count; ++i) {
+      const Event &event = ring->events[i % RING_SIZE];
+      // Timestamps are in microseconds
+      out << ",\n{\"ph\":\"X\",\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << ring->id
+        << ",\"ts\":" << QString::number(event.start / 1000.0, 'f', 3)
+        << ",\"dur\":" << QString::number((event.end - event.start) / 1000.0, 'f', 3) << "}";
+    }
+  }
+  out << "\n]}\n";
+  locker.unlock();
+  
+  _enabled.store(wasEnabled);
+  return out.status() == QTextStream::Ok;
+}
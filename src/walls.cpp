@@ -0,0 +1,291 @@
+#include "walls.hpp"
+#include "board_file.hpp"
+#include "ray_cast.hpp"
+
+#include <QVarLengthArray>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  // Earliest time in [0, t] at which a circle moving from p by d touches
+  // the circle of radius r around e
+  bool sweepPoint(const double ex, const double ey, const double px, const double py,
+    const double dx, const double dy, const double r, double &t, double &nx, double &ny)
+  {
+    const double fx = px - ex;
+    const double fy = py - ey;
+    const double a = dx * dx + dy * dy;
+    const double b = 2.0 * (fx * dx + fy * dy);
+    const double c = fx * fx + fy * fy - r * r;
+    if(a == 0.0 || b >= 0.0) return false;
+    
+    double tc = 0.0;
+    if(c > 0.0) {
+      const double disc = b * b - 4.0 * a * c;
+      if(disc < 0.0) return false;
+      tc = (-b - std::sqrt(disc)) / (2.0 * a);
+    }
+    if(tc > t) return false;
+    
+    const double cx = fx + dx * tc;
+    const double cy = fy + dy * tc;
+    const double len = std::sqrt(cx * cx + cy * cy);
+    if(len == 0.0) return false;
+    t = tc;
+    nx = cx / len;
+    ny = cy / len;
+    return true;
+  }
+  
+  bool sweepSegment(const Walls::Segment &s, const double px, const double py,
+    const double dx, const double dy, const double r, double &t, double &nx, double &ny)
+  {
+    bool hit = false;
+    const double ex = s.x2 - s.x1;
+    const double ey = s.y2 - s.y1;
+    const double len2 = ex * ex + ey * ey;
+    if(len2 > 0.0) {
+      // Face of the segment on the side the circle is on
+      const double len = std::sqrt(len2);
+      double lnx = -ey / len;
+      double lny = ex / len;
+      double dist = (px - s.x1) * lnx + (py - s.y1) * lny;
+      if(dist < 0.0) {
+        lnx = -lnx;
+        lny = -lny;
+        dist = -dist;
+      }
+      
+      const double approach = dx * lnx + dy * lny;
+      if(approach < 0.0) {
+        const double tc = qMax(0.0, (dist - r) / -approach);
+        if(tc <= t) {
+          const double u = ((px + dx * tc - s.x1) * ex + (py + dy * tc - s.y1) * ey) / len2;
+          if(u >= 0.0 && u <= 1.0) {
+            t = tc;
+            nx = lnx;
+            ny = lny;
+            hit = true;
+          }
+        }
+      }
+    }
+    
+    hit |= sweepPoint(s.x1, s.y1, px, py, dx, dy, r, t, nx, ny);
+    hit |= sweepPoint(s.x2, s.y2, px, py, dx, dy, r, t, nx, ny);
+    return hit;
+  }
+}
+
+Walls::Walls(const BoardFile *const board)
+  : _x(0.0)
+  , _y(0.0)
+  , _cellSize(1.0)
+  , _columns(0)
+  , _rows(0)
+{
+  _start.fill(0, 1);
+  _tapeStart.fill(0, 1);
+  if(!board) return;
+  
+  // Renumber the Real lines densely and keep only them in each cell
+  const BoardFile::Line *const lines = board->lines();
+  QVector<qint32> remap(board->lineCount(), -1);
+  for(quint32 i = 0; i < board->lineCount(); ++i) {
+    if(lines[i].type != BoardFile::Real) continue;
+    remap[i] = _segments.size();
+    const Segment s = { lines[i].x1, lines[i].y1, lines[i].x2, lines[i].y2 };
+    _segments.append(s);
+    _sx.append(s.x1);
+    _sy.append(s.y1);
+    _sex.append(s.x2 - s.x1);
+    _sey.append(s.y2 - s.y1);
+  }
+  
+  const BoardFile::Grid &grid = board->grid();
+  _x = grid.x;
+  _y = grid.y;
+  if(grid.cellSize > 0.0) _cellSize = grid.cellSize;
+  _columns = grid.columns;
+  _rows = grid.rows;
+  
+  const quint32 cells = grid.columns * grid.rows;
+  _start.fill(0, cells + 1);
+  for(quint32 c = 0; c < cells; ++c) {
+    for(quint32 j = grid.start[c]; j < grid.start[c + 1]; ++j) {
+      const qint32 s = remap[grid.items[j]];
+      if(s >= 0) _items.append(s);
+    }
+    _start[c + 1] = _items.size();
+  }
+  
+  // Board lines are drawn with QPen's default square caps, which reach half
+  // the pen width past both ends; these are the bounds the scene reports
+  const BoardFile::Style *const styles = board->styles();
+  for(quint32 i = 0; i < board->lineCount(); ++i) {
+    const BoardFile::Line &l = lines[i];
+    if(l.type != BoardFile::Tape) continue;
+    const double dx = l.x2 - l.x1;
+    const double dy = l.y2 - l.y1;
+    const double length = std::sqrt(dx * dx + dy * dy);
+    const double half = styles[l.style].penWidth / 2.0;
+    const double reach = length > 0.0 ? half * (std::fabs(dx) + std::fabs(dy)) / length : half;
+    const Box box = { qMin(l.x1, l.x2) - reach, qMin(l.y1, l.y2) - reach,
+      qMax(l.x1, l.x2) + reach, qMax(l.y1, l.y2) + reach };
+    _tapes.append(box);
+  }
+  
+  // Count, then fill
+  _tapeStart.fill(0, cells + 1);
+  for(int pass = 0; pass < 2; ++pass) {
+    QVector<quint32> cursor;
+    if(pass) {
+      for(quint32 c = 0; c < cells; ++c) _tapeStart[c + 1] += _tapeStart[c];
+      _tapeItems.resize(_tapeStart[cells]);
+      cursor = _tapeStart;
+    }
+    for(int i = 0; i < _tapes.size(); ++i) {
+      const Box &b = _tapes[i];
+      int c0, r0, c1, r1;
+      cellRange(b.x0, b.y0, b.x1, b.y1, c0, r0, c1, r1);
+      for(int r = r0; r <= r1; ++r) {
+        for(int c = c0; c <= c1; ++c) {
+          const int cell = r * _columns + c;
+          if(pass) _tapeItems[cursor[cell]++] = i;
+          else ++_tapeStart[cell + 1];
+        }
+      }
+    }
+  }
+}
+
+double Walls::sweep(const QPointF &from, const QPointF &delta, const double radius, QPointF *normal) const
+{
+  const double px = from.x();
+  const double py = from.y();
+  const double dx = delta.x();
+  const double dy = delta.y();
+  
+  int c0, r0, c1, r1;
+  cellRange(qMin(px, px + dx) - radius, qMin(py, py + dy) - radius,
+    qMax(px, px + dx) + radius, qMax(py, py + dy) + radius, c0, r0, c1, r1);
+  
+  double t = 1.0;
+  double nx = 0.0;
+  double ny = 0.0;
+  for(int r = r0; r <= r1; ++r) {
+    for(int c = c0; c <= c1; ++c) {
+      const int cell = r * _columns + c;
+      for(quint32 j = _start[cell]; j < _start[cell + 1]; ++j) {
+        sweepSegment(_segments[_items[j]], px, py, dx, dy, radius, t, nx, ny);
+      }
+    }
+  }
+  
+  if(normal) *normal = QPointF(nx, ny);
+  return t;
+}
+
+QVector<QPointF> Walls::contacts(const QPointF &center, const double radius, const double slop) const
+{
+  const double reach = radius + slop;
+  int c0, r0, c1, r1;
+  cellRange(center.x() - reach, center.y() - reach, center.x() + reach, center.y() + reach, c0, r0, c1, r1);
+  
+  QVector<QPointF> ret;
+  for(int r = r0; r <= r1; ++r) {
+    for(int c = c0; c <= c1; ++c) {
+      const int cell = r * _columns + c;
+      for(quint32 j = _start[cell]; j < _start[cell + 1]; ++j) {
+        const Segment &s = _segments[_items[j]];
+        const double ex = s.x2 - s.x1;
+        const double ey = s.y2 - s.y1;
+        const double len2 = ex * ex + ey * ey;
+        double u = 0.0;
+        if(len2 > 0.0) u = qBound(0.0, ((center.x() - s.x1) * ex + (center.y() - s.y1) * ey) / len2, 1.0);
+        
+        const QPointF dir(s.x1 + ex * u - center.x(), s.y1 + ey * u - center.y());
+        const double dist = std::sqrt(dir.x() * dir.x() + dir.y() * dir.y());
+        if(dist > reach || dist == 0.0) continue;
+        ret.append(dir / dist);
+      }
+    }
+  }
+  return ret;
+}
+
+void Walls::cast(const QPointF &origin, const double *const dx, const double *const dy,
+  const quint32 rays, const double maxRange, double *const ranges) const
+{
+  int c0, r0, c1, r1;
+  cellRange(origin.x() - maxRange, origin.y() - maxRange,
+    origin.x() + maxRange, origin.y() + maxRange, c0, r0, c1, r1);
+  
+  // Segments span several cells; test each candidate once
+  QVarLengthArray<quint32, 64> candidates;
+  for(int r = r0; r <= r1; ++r) {
+    for(int c = c0; c <= c1; ++c) {
+      const int cell = r * _columns + c;
+      for(quint32 j = _start[cell]; j < _start[cell + 1]; ++j) candidates.append(_items[j]);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end());
+  const int count = std::unique(candidates.begin(), candidates.end()) - candidates.begin();
+  
+  QVarLengthArray<double, 64> x(count);
+  QVarLengthArray<double, 64> y(count);
+  QVarLengthArray<double, 64> ex(count);
+  QVarLengthArray<double, 64> ey(count);
+  for(int i = 0; i < count; ++i) {
+    const quint32 k = candidates[i];
+    x[i] = _sx[k];
+    y[i] = _sy[k];
+    ex[i] = _sex[k];
+    ey[i] = _sey[k];
+  }
+  
+  const RayCastSegments segments = { x.constData(), y.constData(), ex.constData(), ey.constData(),
+    static_cast<quint32>(count) };
+  castRays(segments, origin.x(), origin.y(), dx, dy, rays, maxRange, ranges);
+}
+
+quint32 Walls::tapesAt(const double x, const double y) const
+{
+  int c0, r0, c1, r1;
+  cellRange(x, y, x + 1.0, y + 1.0, c0, r0, c1, r1);
+  
+  // Tapes spanning several of the cells are counted once
+  QVarLengthArray<quint32, 16> hits;
+  for(int r = r0; r <= r1; ++r) {
+    for(int c = c0; c <= c1; ++c) {
+      const int cell = r * _columns + c;
+      for(quint32 j = _tapeStart[cell]; j < _tapeStart[cell + 1]; ++j) {
+        const Box &b = _tapes[_tapeItems[j]];
+        if(b.x0 < x + 1.0 && x < b.x1 && b.y0 < y + 1.0 && y < b.y1) hits.append(_tapeItems[j]);
+      }
+    }
+  }
+  if(c0 == c1 && r0 == r1) return hits.size();
+  std::sort(hits.begin(), hits.end());
+  return std::unique(hits.begin(), hits.end()) - hits.begin();
+}
+
+quint32 Walls::segmentCount() const
+{
+  return _segments.size();
+}
+
+void Walls::cellRange(const double x0, const double y0, const double x1, const double y1,
+  int &c0, int &r0, int &c1, int &r1) const
+{
+  if(!_columns || !_rows) {
+    c0 = r0 = 0;
+    c1 = r1 = -1;
+    return;
+  }
+  c0 = qBound(0, static_cast<int>(std::floor((x0 - _x) / _cellSize)), _columns - 1);
+  c1 = qBound(0, static_cast<int>(std::floor((x1 - _x) / _cellSize)), _columns - 1);
+  r0 = qBound(0, static_cast<int>(std::floor((y0 - _y) / _cellSize)), _rows - 1);
+  r1 = qBound(0, static_cast<int>(std::floor((y1 - _y) / _cellSize)), _rows - 1);
+}
@@ -0,0 +1,27 @@
+#include "world_snapshot.hpp"
+
+#include <cstring>
+
+WorldSnapshot::WorldSnapshot()
+  : tick(0)
+  , time(0.0)
+  , lightX(0.0)
+  , lightY(0.0)
+  , lightOn(0)
+{
+  memset(&state, 0, sizeof(state));
+  memset(&robot, 0, sizeof(robot));
+  memset(boardName, 0, sizeof(boardName));
+}
+
+void WorldSnapshot::setBoard(const QString &board)
+{
+  const QByteArray utf8 = board.toUtf8();
+  memset(boardName, 0, sizeof(boardName));
+  memcpy(boardName, utf8.constData(), qMin<int>(utf8.size(), sizeof(boardName) - 1));
+}
+
+QString WorldSnapshot::board() const
+{
+  return QString::fromUtf8(boardName);
+}